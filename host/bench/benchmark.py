@@ -0,0 +1,124 @@
+#!/usr/bin/env python
+
+'''
+Project: Ewaste 3D Printer
+Module: benchmark.py
+Functionality: Runs the host benchmarks of the firmware and prints the
+               results as one JSON document, see 'make benchmark'.
+
+Notes:
+    1. Micro-benchmarks come from host/bench/fwbench, in host nanoseconds.
+       They are for comparing revisions on the same machine.
+    2. Every plot in host/bench/plots is compiled with host/gcodec and run
+       through host/sim/simjob. Its job time is on the simulated clock, so
+       it only changes when the firmware or the plot does.
+    3. Usage: benchmark.py [-n ITERATIONS] [-o FILE]
+'''
+
+# System imports
+from __future__ import print_function
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..'))
+FWBENCH = os.path.join(ROOT, 'host', 'bench', 'fwbench')
+GCODEC = os.path.join(ROOT, 'host', 'gcodec', 'gcodec')
+SIMJOB = os.path.join(ROOT, 'host', 'sim', 'simjob')
+PLOTS = os.path.join(ROOT, 'host', 'bench', 'plots')
+
+def revision():
+    '''
+        Function to name the revision being measured.
+
+        Inputs:
+            None.
+
+        Outputs:
+            rev: Output of git describe, or None outside a work tree.
+    '''
+    with open(os.devnull, 'w') as quiet:
+        try:
+            out = subprocess.check_output(['git', 'describe', '--always', '--dirty'],
+                                          cwd=ROOT, stderr=quiet)
+        except (OSError, subprocess.CalledProcessError):
+            return None
+
+    return out.decode().strip()
+
+def micro(iterations=None):
+    '''
+        Function to run the micro-benchmarks.
+
+        Inputs:
+            iterations: Commands or segments per benchmark, None for the
+                        fwbench default.
+
+        Outputs:
+            results: Dictionary parsed from the fwbench output.
+    '''
+    cmd = [FWBENCH] + ([str(iterations)] if iterations else [])
+
+    return json.loads(subprocess.check_output(cmd).decode())
+
+def plot(name):
+    '''
+        Function to run one reference plot on the simulated machine.
+
+        Inputs:
+            name: Path of the G-code file.
+
+        Outputs:
+            result: Dictionary parsed from the simjob output, named after
+                    the plot.
+    '''
+    fd, job = tempfile.mkstemp(suffix='.bin')
+    os.close(fd)
+    quiet = open(os.devnull, 'w')
+    try:
+        subprocess.check_call([GCODEC, name, job], stdout=quiet, stderr=quiet)
+        result = json.loads(subprocess.check_output([SIMJOB, '-j', job]).decode())
+    finally:
+        quiet.close()
+        os.remove(job)
+
+    result['job'] = os.path.splitext(os.path.basename(name))[0]
+    return result
+
+def run(iterations=None):
+    '''
+        Function to run every benchmark.
+
+        Inputs:
+            iterations: Passed on to micro().
+
+        Outputs:
+            results: Dictionary of the revision, the micro-benchmarks and
+                     the plots.
+    '''
+    results = micro(iterations)
+    results['revision'] = revision()
+    results['plots'] = [plot(name) for name in sorted(glob.glob(os.path.join(PLOTS, '*.gcode')))]
+
+    return results
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    iterations = None
+    out = sys.stdout
+
+    while args:
+        opt = args.pop(0)
+        if opt == '-n' and args:
+            iterations = int(args.pop(0))
+        elif opt == '-o' and args:
+            out = open(args.pop(0), 'w')
+        else:
+            sys.stderr.write('usage: benchmark.py [-n ITERATIONS] [-o FILE]\n')
+            sys.exit(1)
+
+    json.dump(run(iterations), out, indent=2, sort_keys=True)
+    out.write('\n')
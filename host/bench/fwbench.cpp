@@ -0,0 +1,482 @@
+/* Project: Ewaste 3D Printer
+ * Module: fwbench.cpp
+ * Functionality: Micro-benchmarks of the firmware hot paths, run in the host
+ *                build and written out as JSON
+ *
+ * Usage: fwbench [iterations]
+ *
+ * Measured are:
+ *  cmd_query 		cmd_exec() of a 'QV' query, reply included
+ *  cmd_segment 	cmd_exec() of an 'S' packet, per packet and per segment
+ *  cmd_gcode 		cmd_exec() of a 'G' packet holding one G1 line
+ *  plan_segment 	gcode_feed() of G1 lines, per segment queued. This is the
+ * 					planning done for every segment: feed to step interval
+ * 					and splitting to fit the queue.
+ *  gcode_parse 	gcode_feed() of a program cut into 'G' packet sized pieces,
+ * 					in lines per second. Lines are moves, comments and
+ * 					modal codes, as in the output of a CAM tool.
+ *  step_tick 		motor_line_raise(), motor_line_step() and motor_line_lower(),
+ * 					the motor work of one step interrupt
+ *  dispatch_switch The switch cmd_exec() used before the opcode table, and
+ *  dispatch_table 	cmd_lookup(), over the same stream of opcodes. Only the
+ * 					handler is found, none is called.
+ *
+ * Figures are host nanoseconds for the firmware compiled natively, against
+ * the simulated backend, so they track changes between revisions rather than
+ * M0+ cycles. Packets are received outside the timed section, and the queue
+ * is emptied between commands so every packet is decoded in full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <chrono>
+#include <vector>
+
+#include <hal.h>
+#include <usb.h>
+#include <commands.h>
+#include <segment.h>
+#include <motor.h>
+#include <gcode.h>
+#include <crc.h>
+
+#define ITERATIONS 		20000
+#define REPEATS 		5 		// Best of, to ride out host noise
+#define PATH_SIDES 		24 		// Polygon the segment packets trace
+#define PATH_RADIUS 	600 	// Steps
+#define STEP_LINE 		30000 	// Steps per motor_line_begin() in step_tick
+#define OPCODE_STREAM 	4096 	// Opcodes in the dispatch stream
+#define PROGRAM_LINES 	4 		// G-code lines per side in gcode_parse
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double bench_ns(bench_clock::duration d)
+{
+	return std::chrono::duration<double, std::nano>(d).count();
+}
+
+static void bench_drain_replies(void)
+{
+	uint8_t buf[BUF_SIZE];
+
+	while (sim_usb_read(buf));
+}
+
+static void bench_drain_queue(void)
+{
+	segment_t seg;
+
+	while (seg_pop(&seg));
+}
+
+// Hand a packet to the firmware as usb_recv() would, outside the timing.
+static void bench_receive(const uint8_t *buf)
+{
+	if (!sim_usb_write(buf))
+	{
+		fprintf(stderr, "fwbench: wire full\n");
+		exit(1);
+	}
+	sim_dispatch();
+	if (!usb_recv())
+	{
+		fprintf(stderr, "fwbench: packet not received\n");
+		exit(1);
+	}
+}
+
+// Time cmd_exec() over a set of packets, used in turn from *next on so
+// sequence numbers carry on between runs.
+static double bench_cmd(const std::vector<std::vector<uint8_t> > &packets, long iterations,
+		size_t *next)
+{
+	bench_clock::duration total(0);
+	bench_clock::time_point begin;
+	double best = 0;
+	long i;
+	int r;
+
+	for (r = 0; r < REPEATS; r++)
+	{
+		total = bench_clock::duration(0);
+		for (i = 0; i < iterations; i++)
+		{
+			bench_receive(packets[(*next)++ % packets.size()].data());
+			begin = bench_clock::now();
+			cmd_exec();
+			total += bench_clock::now() - begin;
+
+			bench_drain_replies();
+			bench_drain_queue();
+		}
+		if (r == 0 || bench_ns(total) < best)
+			best = bench_ns(total);
+	}
+
+	return best / iterations;
+}
+
+static uint8_t bench_varint(uint8_t *p, uint32_t val)
+{
+	uint8_t n = 0;
+
+	do
+	{
+		p[n] = (val & 0x7f) | ((val > 0x7f) ? 0x80 : 0);
+		val >>= 7;
+		n++;
+	} while (val);
+
+	return n;
+}
+
+static uint32_t bench_zigzag(int32_t val)
+{
+	return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+// One 'S' packet per sequence number, each full of polygon edges.
+static uint8_t bench_segments(std::vector<std::vector<uint8_t> > &packets)
+{
+	std::vector<uint8_t> buf(BUF_SIZE);
+	uint8_t *p, *end = buf.data() + SEG_CRC, enc[12], len, nseg = 0;
+	int32_t x, y, px = PATH_RADIUS, py = 0;
+	uint16_t crc;
+	int seq, side = 0;
+
+	for (seq = 1; seq <= 256; seq++)
+	{
+		memset(buf.data(), 0, BUF_SIZE);
+		buf[0] = CMD_SEG;
+		buf[SEG_HDR_SEQ] = seq & 0xff;
+		p = buf.data() + SEG_HDR_SIZE;
+		nseg = 0;
+
+		while (1)
+		{
+			x = (int32_t)(PATH_RADIUS*cos(2*M_PI*(side + 1)/PATH_SIDES));
+			y = (int32_t)(PATH_RADIUS*sin(2*M_PI*(side + 1)/PATH_SIDES));
+
+			// Every packet sets its feed, as gcodec does after a change.
+			enc[0] = SEG_FLAG_X | SEG_FLAG_Y | (nseg ? 0 : SEG_FLAG_F);
+			len = 1;
+			len += bench_varint(enc + len, bench_zigzag(x - px));
+			len += bench_varint(enc + len, bench_zigzag(y - py));
+			if (!nseg)
+				len += bench_varint(enc + len, SEG_FEED_DEFAULT);
+			if (p + len > end)
+				break;
+
+			memcpy(p, enc, len);
+			p += len;
+			nseg++;
+			px = x;
+			py = y;
+			side = (side + 1) % PATH_SIDES;
+		}
+
+		buf[SEG_HDR_COUNT] = nseg;
+		crc = crc16(buf.data(), SEG_CRC);
+		buf[SEG_CRC] = crc & 0xff;
+		buf[SEG_CRC + 1] = crc >> 8;
+		packets.push_back(buf);
+	}
+
+	// Sequence numbers follow on from a resynchronised zero.
+	buf.assign(BUF_SIZE, 0);
+	buf[0] = CMD_SEG;
+	crc = crc16(buf.data(), SEG_CRC);
+	buf[SEG_CRC] = crc & 0xff;
+	buf[SEG_CRC + 1] = crc >> 8;
+	bench_receive(buf.data());
+	cmd_exec();
+	bench_drain_replies();
+
+	return packets[0][SEG_HDR_COUNT];
+}
+
+// G1 lines around the polygon, in mm, each in its own 'G' packet.
+static void bench_gcode(std::vector<std::vector<uint8_t> > &packets, std::vector<char> &text)
+{
+	std::vector<uint8_t> buf(BUF_SIZE);
+	char line[BUF_SIZE];
+	int side, len;
+
+	for (side = 0; side < PATH_SIDES; side++)
+	{
+		len = snprintf(line, sizeof(line), "G1 X%.3f Y%.3f F%d\n",
+				10 + 5*cos(2*M_PI*side/PATH_SIDES), 10 + 5*sin(2*M_PI*side/PATH_SIDES),
+				600 + 60*side);
+		text.insert(text.end(), line, line + len);
+
+		buf.assign(BUF_SIZE, 0);
+		buf[0] = CMD_GCO;
+		buf[1] = len;
+		memcpy(buf.data() + 2, line, len);
+		packets.push_back(buf);
+	}
+}
+
+static double bench_plan(const std::vector<char> &text, long iterations, double *segments)
+{
+	bench_clock::time_point begin;
+	bench_clock::duration total;
+	double best = 0;
+	uint32_t nseg;
+	size_t off, len;
+	long i;
+	int r;
+
+	for (r = 0; r < REPEATS; r++)
+	{
+		total = bench_clock::duration(0);
+		nseg = 0;
+		for (i = 0; i < iterations; i++)
+		{
+			// One line at a time, so the queue never fills.
+			for (off = 0; off < text.size(); off += len)
+			{
+				len = (const char *)memchr(&text[off], '\n', text.size() - off) - &text[off] + 1;
+				begin = bench_clock::now();
+				gcode_feed((const uint8_t *)&text[off], len);
+				total += bench_clock::now() - begin;
+				nseg += seg_count();
+				bench_drain_queue();
+			}
+		}
+		if (r == 0 || bench_ns(total) < best)
+			best = bench_ns(total);
+		*segments = nseg;
+	}
+
+	return best / *segments;
+}
+
+// Program of PROGRAM_LINES lines per side of the polygon.
+static void bench_program(std::vector<char> &text)
+{
+	char line[BUF_SIZE];
+	int side, len;
+
+	for (side = 0; side < PATH_SIDES; side++)
+	{
+		len = snprintf(line, sizeof(line), "(side %d)\nG90 G21\n", side);
+		text.insert(text.end(), line, line + len);
+		len = snprintf(line, sizeof(line), "G1 X%.3f Y%.3f F%d ; edge\nM5\n",
+				10 + 5*cos(2*M_PI*side/PATH_SIDES), 10 + 5*sin(2*M_PI*side/PATH_SIDES),
+				600 + 60*side);
+		text.insert(text.end(), line, line + len);
+	}
+}
+
+static double bench_parse(const std::vector<char> &text, long iterations)
+{
+	bench_clock::time_point begin;
+	bench_clock::duration total;
+	size_t off, len, chunk = BUF_SIZE - 2;
+	double best = 0;
+	long i;
+	int r;
+
+	for (r = 0; r < REPEATS; r++)
+	{
+		total = bench_clock::duration(0);
+		for (i = 0; i < iterations; i++)
+		{
+			for (off = 0; off < text.size(); off += len)
+			{
+				len = (text.size() - off < chunk) ? text.size() - off : chunk;
+				begin = bench_clock::now();
+				gcode_feed((const uint8_t *)&text[off], len);
+				total += bench_clock::now() - begin;
+				bench_drain_queue();
+			}
+		}
+		if (r == 0 || bench_ns(total) < best)
+			best = bench_ns(total);
+	}
+
+	return (double)iterations*PATH_SIDES*PROGRAM_LINES*1e9 / best;
+}
+
+static double bench_step(long iterations)
+{
+	bench_clock::time_point begin;
+	double best = 0, ns;
+	long i, done;
+	int r;
+
+	for (r = 0; r < REPEATS; r++)
+	{
+		begin = bench_clock::now();
+		for (done = 0; done < iterations; done += STEP_LINE)
+		{
+			motor_line_begin(STEP_LINE, STEP_LINE/3, 0);
+			for (i = 0; i < STEP_LINE; i++)
+			{
+				motor_line_raise();
+				motor_line_step();
+				motor_line_lower();
+			}
+		}
+		ns = bench_ns(bench_clock::now() - begin);
+		if (r == 0 || ns < best)
+			best = ns;
+	}
+
+	return best / done;
+}
+
+// Dispatch as cmd_exec() did before the opcode table, for comparison.
+static cmd_handler_t __attribute__((noinline)) bench_switch(uint8_t opcode)
+{
+	switch(opcode)
+	{
+		case CMD_CAL:
+			return cmd_cali;
+
+		case CMD_ECH:
+			return cmd_echo;
+
+		case CMD_GCO:
+			return cmd_gcode;
+
+		case CMD_HLT:
+			return cmd_halt;
+
+		case CMD_MOV:
+			return cmd_move;
+
+		case CMD_QRY:
+			return cmd_query;
+
+		case CMD_TEL:
+			return cmd_telemetry;
+
+		case CMD_SEG:
+			return cmd_segment;
+
+		case CMD_TST:
+			return cmd_test;
+
+		default:
+			return NULL;
+	}
+}
+
+// Every opcode and a few unknown bytes, in a fixed pseudo-random order.
+static void bench_opcodes(std::vector<uint8_t> &ops)
+{
+	static const uint8_t known[] =
+	{
+		CMD_CAL, CMD_ECH, CMD_GCO, CMD_HLT, CMD_MOV, CMD_QRY, CMD_TEL, CMD_SEG, CMD_TST,
+		0, 'A', 'Z', 'a', 0xff,
+	};
+	uint32_t seed = 1;
+	int i;
+
+	for (i = 0; i < OPCODE_STREAM; i++)
+	{
+		seed = seed*1103515245 + 12345;
+		ops.push_back(known[(seed >> 16) % sizeof(known)]);
+	}
+
+	// Both must find the same handlers.
+	for (i = 0; i < OPCODE_STREAM; i++)
+		if (bench_switch(ops[i]) != cmd_lookup(ops[i]))
+		{
+			fprintf(stderr, "fwbench: opcode 0x%02x dispatched differently\n", ops[i]);
+			exit(1);
+		}
+}
+
+static double bench_dispatch(const std::vector<uint8_t> &ops, long iterations,
+		cmd_handler_t (*lookup)(uint8_t))
+{
+	bench_clock::time_point begin;
+	volatile uintptr_t sink = 0;
+	double best = 0, ns;
+	uintptr_t acc;
+	long i;
+	int r;
+
+	for (r = 0; r < REPEATS; r++)
+	{
+		acc = 0;
+		begin = bench_clock::now();
+		for (i = 0; i < iterations; i++)
+			acc ^= (uintptr_t)lookup(ops[i % OPCODE_STREAM]);
+		ns = bench_ns(bench_clock::now() - begin);
+		sink = sink ^ acc;
+		if (r == 0 || ns < best)
+			best = ns;
+	}
+
+	return best / iterations;
+}
+
+static void bench_print(const char *name, const char *unit, long iterations, double value,
+		int last)
+{
+	printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %ld, "
+			"\"value\": %.2f}%s\n", name, unit, iterations, value, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::vector<uint8_t> > query(1, std::vector<uint8_t>(BUF_SIZE)), seg, gco;
+	std::vector<uint8_t> ops;
+	std::vector<char> text, program;
+	long iterations = (argc > 1) ? atol(argv[1]) : ITERATIONS;
+	double per_packet, per_segment, segments;
+	size_t next_query = 0, next_seg = 0, next_gco = 0;
+	uint8_t nseg;
+
+	if (iterations <= 0)
+	{
+		fprintf(stderr, "usage: fwbench [iterations]\n");
+		return 1;
+	}
+
+	// The firmware waits in setup() for the first packet.
+	query[0][0] = CMD_QRY;
+	query[0][1] = CMD_QRY_V;
+	sim_usb_write(query[0].data());
+	sim_host = bench_drain_replies;
+	setup();
+	while (usb_recv())
+		cmd_exec();
+	bench_drain_replies();
+
+	nseg = bench_segments(seg);
+	bench_gcode(gco, text);
+	bench_program(program);
+	bench_opcodes(ops);
+
+	per_packet = bench_cmd(seg, iterations, &next_seg);
+	per_segment = per_packet / nseg;
+
+	printf("{\n  \"f_cpu\": %d,\n  \"version\": \"%d.%d\",\n  \"benchmarks\": [\n",
+			F_CPU, CMD_VERSION_MAJOR, CMD_VERSION_MINOR);
+	bench_print("cmd_query", "ns/command", iterations, bench_cmd(query, iterations, &next_query), 0);
+	bench_print("cmd_segment", "ns/packet", iterations, per_packet, 0);
+	bench_print("cmd_segment", "ns/segment", iterations, per_segment, 0);
+	bench_print("cmd_gcode", "ns/command", iterations, bench_cmd(gco, iterations, &next_gco), 0);
+	bench_print("plan_segment", "ns/segment", iterations,
+			bench_plan(text, iterations / PATH_SIDES + 1, &segments), 0);
+	bench_print("gcode_parse", "lines/s", iterations,
+			bench_parse(program, iterations / PATH_SIDES + 1), 0);
+	// The step interrupt stops on the empty queue before lines are stepped here.
+	seg_drain();
+	bench_print("step_tick", "ns/step", iterations*10, bench_step(iterations*10), 0);
+	bench_print("dispatch_switch", "ns/command", iterations*10,
+			bench_dispatch(ops, iterations*10, bench_switch), 0);
+	bench_print("dispatch_table", "ns/command", iterations*10,
+			bench_dispatch(ops, iterations*10, cmd_lookup), 1);
+	printf("  ]\n}\n");
+
+	return 0;
+}
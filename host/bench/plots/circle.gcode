@@ -0,0 +1,9 @@
+; Concentric circles, arcs cut into short chords
+G21 G90
+G0 X33.75 Y18.75
+G2 X33.75 Y18.75 I-15 J0 F900
+G0 X28.75 Y18.75
+G3 X28.75 Y18.75 I-10 J0 F600
+G0 X23.75 Y18.75
+G2 X23.75 Y18.75 I-5 J0 F300
+G0 X0 Y0
@@ -0,0 +1,78 @@
+; Hatch fill, many short moves with direction reversals
+G21 G90
+G0 X5 Y5
+G1 X32.5 Y5.00 F1500
+G1 Y5.75
+G1 X5.0 Y5.75 F1500
+G1 Y6.50
+G1 X32.5 Y6.50 F1500
+G1 Y7.25
+G1 X5.0 Y7.25 F1500
+G1 Y8.00
+G1 X32.5 Y8.00 F1500
+G1 Y8.75
+G1 X5.0 Y8.75 F1500
+G1 Y9.50
+G1 X32.5 Y9.50 F1500
+G1 Y10.25
+G1 X5.0 Y10.25 F1500
+G1 Y11.00
+G1 X32.5 Y11.00 F1500
+G1 Y11.75
+G1 X5.0 Y11.75 F1500
+G1 Y12.50
+G1 X32.5 Y12.50 F1500
+G1 Y13.25
+G1 X5.0 Y13.25 F1500
+G1 Y14.00
+G1 X32.5 Y14.00 F1500
+G1 Y14.75
+G1 X5.0 Y14.75 F1500
+G1 Y15.50
+G1 X32.5 Y15.50 F1500
+G1 Y16.25
+G1 X5.0 Y16.25 F1500
+G1 Y17.00
+G1 X32.5 Y17.00 F1500
+G1 Y17.75
+G1 X5.0 Y17.75 F1500
+G1 Y18.50
+G1 X32.5 Y18.50 F1500
+G1 Y19.25
+G1 X5.0 Y19.25 F1500
+G1 Y20.00
+G1 X32.5 Y20.00 F1500
+G1 Y20.75
+G1 X5.0 Y20.75 F1500
+G1 Y21.50
+G1 X32.5 Y21.50 F1500
+G1 Y22.25
+G1 X5.0 Y22.25 F1500
+G1 Y23.00
+G1 X32.5 Y23.00 F1500
+G1 Y23.75
+G1 X5.0 Y23.75 F1500
+G1 Y24.50
+G1 X32.5 Y24.50 F1500
+G1 Y25.25
+G1 X5.0 Y25.25 F1500
+G1 Y26.00
+G1 X32.5 Y26.00 F1500
+G1 Y26.75
+G1 X5.0 Y26.75 F1500
+G1 Y27.50
+G1 X32.5 Y27.50 F1500
+G1 Y28.25
+G1 X5.0 Y28.25 F1500
+G1 Y29.00
+G1 X32.5 Y29.00 F1500
+G1 Y29.75
+G1 X5.0 Y29.75 F1500
+G1 Y30.50
+G1 X32.5 Y30.50 F1500
+G1 Y31.25
+G1 X5.0 Y31.25 F1500
+G1 Y32.00
+G1 X32.5 Y32.00 F1500
+G1 Y32.75
+G0 X0 Y0
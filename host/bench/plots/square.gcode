@@ -0,0 +1,13 @@
+; Nested squares, long straight moves at two feeds
+G21 G90
+G0 X5 Y5
+G1 X32.5 F600
+G1 Y32.5
+G1 X5
+G1 Y5
+G0 X10 Y10
+G1 X27.5 F1200
+G1 Y27.5
+G1 X10
+G1 Y10
+G0 X0 Y0
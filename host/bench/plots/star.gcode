@@ -0,0 +1,20 @@
+; Five pointed star with a pen lift on Z between passes
+G21 G90
+G0 Z2
+G0 X18.750 Y33.750
+G1 Z0 F300
+G1 X27.567 Y6.615 F900
+G1 X4.484 Y23.385 F900
+G1 X33.016 Y23.385 F900
+G1 X9.933 Y6.615 F900
+G1 X18.750 Y33.750 F900
+G0 Z2
+G0 X18.750 Y26.750
+G1 Z0 F300
+G1 X23.452 Y12.278 F450
+G1 X11.142 Y21.222 F450
+G1 X26.358 Y21.222 F450
+G1 X14.048 Y12.278 F450
+G1 X18.750 Y26.750 F450
+G0 Z2
+G0 X0 Y0
@@ -0,0 +1,98 @@
+/* Project: Ewaste 3D Printer
+ * Module: txcount.cpp
+ * Functionality: Micro-benchmark of counting queued USB tx packets, walking
+ *                the queue as usb_dev.c used to against reading the counter
+ *                it keeps now
+ *
+ * Usage: txcount [iterations]
+ *
+ * The counter read is usb_tx_packet_count() from usb_dev.h itself, over the
+ * counters usb_dev.c keeps, defined here. The walk it replaced is no longer
+ * in the tree, so it is copied below as it was. Figures are host
+ * nanoseconds, not M0+ cycles. Only the time of each count is measured: on
+ * the device the walk also masked interrupts for all of it, which has no
+ * host equivalent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+
+#include <usb_dev.h>
+
+#define DEPTH_MAX 		16 		// Deepest queue measured
+#define ITERATIONS 		2000000
+#define ENDPOINT 		RAWHID_TX_ENDPOINT
+
+// Kept by usb_tx() and usb_isr() on the device
+volatile uint16_t usb_tx_byte_count_data[NUM_ENDPOINTS];
+volatile uint8_t usb_tx_packet_count_data[NUM_ENDPOINTS];
+
+static usb_packet_t *tx_first[NUM_ENDPOINTS];
+
+// Previous usb_tx_packet_count(), less the interrupt mask
+static uint32_t count_walk(uint32_t endpoint)
+{
+	const usb_packet_t *p;
+	uint32_t count=0;
+
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS) return 0;
+	for (p = tx_first[endpoint]; p; p = p->next) count++;
+	return count;
+}
+
+static uint32_t count_counter(uint32_t endpoint)
+{
+	return usb_tx_packet_count(endpoint);
+}
+
+template <typename F> static double measure(F f, long iterations)
+{
+	std::chrono::steady_clock::time_point begin, end;
+	uint32_t sink = 0;
+	long i;
+
+	begin = std::chrono::steady_clock::now();
+	for (i = 0; i < iterations; i++)
+		sink += f(ENDPOINT);
+	end = std::chrono::steady_clock::now();
+
+	// Keeps the calls from being optimised away.
+	if (sink == 0xffffffff)
+		printf(" ");
+
+	return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<usb_packet_t> pool(DEPTH_MAX);
+	long iterations = (argc > 1) ? atol(argv[1]) : ITERATIONS;
+	double walk, counter;
+	int depth, i;
+
+	// The walk is masked end to end, the counter read not at all.
+	printf("depth   walk ns  counter ns\n");
+	for (depth = 0; depth <= DEPTH_MAX; depth = depth ? 2*depth : 1)
+	{
+		for (i = 0; i < depth; i++)
+			pool[i].next = (i + 1 < depth) ? &pool[i + 1] : NULL;
+		tx_first[ENDPOINT - 1] = depth ? &pool[0] : NULL;
+		usb_tx_packet_count_data[ENDPOINT - 1] = depth;
+
+		walk = measure(count_walk, iterations);
+		counter = measure(count_counter, iterations);
+		if (count_walk(ENDPOINT) != count_counter(ENDPOINT))
+		{
+			fprintf(stderr, "txcount: counts differ at depth %d\n", depth);
+			return 1;
+		}
+		printf("%5d %9.2f %11.2f\n", depth, walk, counter);
+	}
+
+	return 0;
+}
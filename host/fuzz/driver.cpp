@@ -0,0 +1,435 @@
+/* Project: Ewaste 3D Printer
+ * Module: driver.cpp
+ * Functionality: Small coverage-guided fuzzing engine for the targets in
+ *                host/fuzz, for compilers without libFuzzer
+ *
+ * Usage: fuzz_cmd [-runs=N] [-max_total_time=S] [-max_len=N] [-seed=N]
+ *                 [-timeout=S] [CORPUS_DIR | INPUT ...]
+ *
+ * Takes the same flags and arguments as libFuzzer, so the target builds with
+ * either. Given files, each is run once, which is how a failure is
+ * reproduced. Given directories, their inputs seed the corpus and inputs
+ * that reach new code are written to the first one.
+ *
+ * Coverage comes from -fsanitize-coverage=trace-pc, which calls
+ * __sanitizer_cov_trace_pc() on every basic block of the instrumented code.
+ * Blocks are hashed into a bitmap and an input is kept when it sets a new
+ * bit. Inputs are mutated by flipping bits, setting bytes, inserting,
+ * erasing and copying ranges and splicing with another corpus entry.
+ *
+ * Inputs run in one worker process, one after another, as under libFuzzer.
+ * The target settles the firmware between them. The input being run is kept
+ * in memory shared with the parent. If the worker fails, with a sanitizer
+ * report, an abort or a hang past the timeout, the parent runs that input
+ * again alone in a fresh process, so it is known whether it fails without
+ * the state earlier inputs left. It is then saved as crash-<hash> or
+ * timeout-<hash> and fuzzing stops. Given files are run the same way, each
+ * in a fresh process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#define COV_BITS 		16
+#define COV_SIZE 		(1 << COV_BITS)
+#define MAX_LEN_DEFAULT 1040 	// Sixteen fuzz_cmd records
+#define PULSE_RUNS 		1000 	// Runs between status lines
+#define MUTATIONS_MAX 	8 		// Stacked on one input
+#define TIMEOUT_DEFAULT 60 		// Seconds for one input
+#define MAX_LEN_LIMIT 	65536 	// Largest -max_len
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+typedef std::vector<uint8_t> input_t;
+
+// Shared with the forked runs
+typedef struct
+{
+	uint8_t seen[COV_SIZE]; 	// Blocks reached by any input
+	size_t count; 				// Bits set in seen
+} cov_map_t;
+
+// Input the worker is running, shared with the parent
+typedef struct
+{
+	size_t size;
+	uint8_t data[MAX_LEN_LIMIT];
+} fuzz_current_t;
+
+static cov_map_t *cov = NULL;
+static fuzz_current_t *current = NULL;
+static std::vector<input_t> corpus;
+static std::mt19937 rng;
+static unsigned fuzz_time_limit = TIMEOUT_DEFAULT;
+
+static const uint8_t fuzz_interesting[] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x0f, 0x10, 0x3f, 0x40, 0x7f, 0x80, 0x81, 0xfe, 0xff,
+	'C', 'G', 'H', 'M', 'Q', 'R', 'S', 'T', 'X', 'Y', 'Z', '\n', ' ', '-', '.', '0', '9',
+};
+
+extern "C" void __sanitizer_cov_trace_pc(void)
+{
+	uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+	uint32_t idx = (uint32_t)((pc ^ (pc >> COV_BITS)) & (COV_SIZE - 1));
+
+	if (cov && !cov->seen[idx])
+	{
+		cov->seen[idx] = 1;
+		cov->count++;
+	}
+}
+
+static uint64_t input_hash(const input_t &in)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < in.size(); i++)
+		h = (h ^ in[i])*0x100000001b3ULL;
+
+	return h;
+}
+
+static void input_save(const input_t &in, const std::string &dir, const char *prefix)
+{
+	char name[64];
+	std::string path;
+	FILE *f;
+
+	snprintf(name, sizeof(name), "%s%016llx", prefix, (unsigned long long)input_hash(in));
+	path = dir.empty() ? name : dir + "/" + name;
+	f = fopen(path.c_str(), "wb");
+	if (f == NULL)
+		return;
+	if (!in.empty())
+		fwrite(in.data(), 1, in.size(), f);
+	fclose(f);
+	if (dir.empty())
+		fprintf(stderr, "wrote %s (%zu bytes)\n", path.c_str(), in.size());
+}
+
+static uint8_t input_load(const std::string &path, input_t &in)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	uint8_t buf[4096];
+	size_t n;
+
+	if (f == NULL)
+		return 0;
+
+	in.clear();
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		in.insert(in.end(), buf, buf + n);
+	fclose(f);
+
+	return 1;
+}
+
+static void corpus_load(const std::string &dir, size_t max_len)
+{
+	struct dirent *e;
+	std::string path;
+	struct stat st;
+	input_t in;
+	DIR *d;
+
+	d = opendir(dir.c_str());
+	if (d == NULL)
+		return;
+
+	while ((e = readdir(d)) != NULL)
+	{
+		path = dir + "/" + e->d_name;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (input_load(path, in) && in.size() <= max_len)
+			corpus.push_back(in);
+	}
+	closedir(d);
+}
+
+static size_t rand_below(size_t n)
+{
+	return n ? rng() % n : 0;
+}
+
+static void input_mutate(input_t &in, size_t max_len)
+{
+	size_t pos, len, from, n = 1 + rand_below(MUTATIONS_MAX);
+	const input_t *other;
+	input_t copy;
+
+	while (n--)
+	{
+		pos = rand_below(in.size());
+		switch (rand_below(7))
+		{
+			case 0: 	// Flip a bit
+				if (!in.empty())
+					in[pos] ^= 1 << rand_below(8);
+				break;
+
+			case 1: 	// Set a random byte
+				if (!in.empty())
+					in[pos] = rng();
+				break;
+
+			case 2: 	// Set an interesting byte
+				if (!in.empty())
+					in[pos] = fuzz_interesting[rand_below(sizeof(fuzz_interesting))];
+				break;
+
+			case 3: 	// Insert random bytes
+				len = 1 + rand_below(16);
+				for (; len-- && in.size() < max_len;)
+					in.insert(in.begin() + rand_below(in.size() + 1), (uint8_t)rng());
+				break;
+
+			case 4: 	// Erase a range
+				if (!in.empty())
+				{
+					len = 1 + rand_below(in.size() - pos);
+					in.erase(in.begin() + pos, in.begin() + pos + len);
+				}
+				break;
+
+			case 5: 	// Copy a range elsewhere
+				if (!in.empty())
+				{
+					len = 1 + rand_below(in.size() - pos);
+					copy.assign(in.begin() + pos, in.begin() + pos + len);
+					in.insert(in.begin() + rand_below(in.size() + 1), copy.begin(), copy.end());
+				}
+				break;
+
+			case 6: 	// Splice with another input
+				other = &corpus[rand_below(corpus.size())];
+				if (other->empty())
+					break;
+				from = rand_below(other->size());
+				len = 1 + rand_below(other->size() - from);
+				in.resize(pos);
+				in.insert(in.end(), other->begin() + from, other->begin() + from + len);
+				break;
+		}
+	}
+
+	if (in.size() > max_len)
+		in.resize(max_len);
+}
+
+// Run one input in the worker. Returns the new coverage.
+static size_t fuzz_run(const input_t &in)
+{
+	size_t before = cov->count;
+
+	current->size = in.size();
+	if (!in.empty())
+		memcpy(current->data, in.data(), in.size());
+
+	alarm(fuzz_time_limit);
+	LLVMFuzzerTestOneInput(in.data(), in.size());
+	alarm(0);
+
+	return cov->count - before;
+}
+
+// Run one input alone in a fresh process. Returns its wait status.
+static int fuzz_alone(const input_t &in)
+{
+	int status;
+	pid_t pid;
+
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+	{
+		alarm(fuzz_time_limit);
+		LLVMFuzzerTestOneInput(in.data(), in.size());
+		_exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) != pid)
+	{
+		perror("waitpid");
+		exit(1);
+	}
+
+	return status;
+}
+
+static uint8_t fuzz_failed(int status)
+{
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static uint8_t fuzz_timed_out(int status)
+{
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM;
+}
+
+static void fuzz_loop(const std::vector<std::string> &dirs, long runs, long max_time,
+		size_t max_len, time_t start)
+{
+	input_t in;
+	long run;
+	size_t i;
+
+	for (i = 0; i < dirs.size(); i++)
+		corpus_load(dirs[i], max_len);
+	corpus.push_back(input_t());
+
+	for (i = 0; i < corpus.size(); i++)
+		fuzz_run(corpus[i]);
+	fprintf(stderr, "#%zu\tINITED\tcov: %zu corp: %zu\n", corpus.size(), cov->count,
+			corpus.size());
+
+	for (run = 0; runs < 0 || run < runs; run++)
+	{
+		if (max_time && time(NULL) - start >= max_time)
+			break;
+
+		in = corpus[rand_below(corpus.size())];
+		input_mutate(in, max_len);
+		if (fuzz_run(in))
+		{
+			corpus.push_back(in);
+			fprintf(stderr, "#%ld\tNEW\tcov: %zu corp: %zu len: %zu\n", run, cov->count,
+					corpus.size(), in.size());
+			if (!dirs.empty())
+				input_save(in, dirs[0], "");
+		}
+		else if (run % PULSE_RUNS == 0)
+			fprintf(stderr, "#%ld\tpulse\tcov: %zu corp: %zu\n", run, cov->count,
+					corpus.size());
+	}
+
+	fprintf(stderr, "#%ld\tDONE\tcov: %zu corp: %zu in %ld s\n", run, cov->count,
+			corpus.size(), (long)(time(NULL) - start));
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> dirs, files;
+	long runs = -1, max_time = 0;
+	size_t max_len = MAX_LEN_DEFAULT, i;
+	unsigned long seed = time(NULL);
+	time_t start = time(NULL);
+	struct stat st;
+	pid_t worker;
+	int status;
+	input_t in;
+
+	for (i = 1; i < (size_t)argc; i++)
+	{
+		if (sscanf(argv[i], "-runs=%ld", &runs) == 1 ||
+				sscanf(argv[i], "-max_total_time=%ld", &max_time) == 1 ||
+				sscanf(argv[i], "-max_len=%zu", &max_len) == 1 ||
+				sscanf(argv[i], "-seed=%lu", &seed) == 1 ||
+				sscanf(argv[i], "-timeout=%u", &fuzz_time_limit) == 1)
+			continue;
+		if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "ignoring %s\n", argv[i]);
+			continue;
+		}
+		if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+			dirs.push_back(argv[i]);
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (max_len > MAX_LEN_LIMIT)
+		max_len = MAX_LEN_LIMIT;
+
+	cov = (cov_map_t *)mmap(NULL, sizeof(cov_map_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	current = (fuzz_current_t *)mmap(NULL, sizeof(fuzz_current_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (cov == MAP_FAILED || current == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+
+	// Reproduce mode, each file once.
+	if (!files.empty())
+	{
+		for (i = 0; i < files.size(); i++)
+		{
+			if (!input_load(files[i], in))
+			{
+				perror(files[i].c_str());
+				return 1;
+			}
+			fprintf(stderr, "running %s\n", files[i].c_str());
+			status = fuzz_alone(in);
+			if (fuzz_failed(status))
+			{
+				if (fuzz_timed_out(status))
+					fprintf(stderr, "input ran longer than %u s\n", fuzz_time_limit);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	rng.seed(seed);
+	fprintf(stderr, "seed %lu\n", seed);
+
+	fflush(stderr);
+	worker = fork();
+	if (worker < 0)
+	{
+		perror("fork");
+		return 1;
+	}
+	if (worker == 0)
+	{
+		fuzz_loop(dirs, runs, max_time, max_len, start);
+		_exit(0);
+	}
+
+	if (waitpid(worker, &status, 0) != worker)
+	{
+		perror("waitpid");
+		return 1;
+	}
+	if (!fuzz_failed(status))
+		return 0;
+
+	// Save what the worker was running, and see whether it fails alone.
+	in.assign(current->data, current->data + current->size);
+	if (fuzz_timed_out(status))
+	{
+		fprintf(stderr, "input ran longer than %u s\n", fuzz_time_limit);
+		input_save(in, "", "timeout-");
+	}
+	else
+		input_save(in, "", "crash-");
+
+	fprintf(stderr, "running it alone\n");
+	if (!fuzz_failed(fuzz_alone(in)))
+		fprintf(stderr, "it does not fail alone, it needs the state earlier inputs left\n");
+
+	return 1;
+}
@@ -0,0 +1,203 @@
+/* Project: Ewaste 3D Printer
+ * Module: fuzz_cmd.cpp
+ * Functionality: Fuzz target for cmd_exec() and the packet decoders behind
+ *                it, run on the host build against the machine model
+ *
+ * An input is a series of records, each a control byte and up to a packet:
+ *  bits 0-5 	Milliseconds to let the firmware run after the packet
+ *  bit 6 		Sequence the packet just after seg_seq, plus [1] modulo
+ * 				SEG_WINDOW + 1, so held packets are reached
+ *  bit 7 		Stamp a valid segment CRC, so the decoders are reached
+ * Packets go through the simulated USB link and the main loop, so commands
+ * run as on the device, segments are stepped out by the step interrupt and
+ * the machine in host/sim/machine.h answers with switches and the encoder.
+ *
+ * Checked after every pass of the main loop:
+ *  - The motion queue never holds more than SEG_QUEUE_SIZE segments.
+ *  - Every report has a known type and at most SEG_QUEUE_SIZE credits, and
+ *    every 'S' reply a known status.
+ *  - The firmware X and Y positions match the machine, so no command steps
+ *    without counting or counts without stepping.
+ *  - No X or Y step is lost against an end stop.
+ * And at the end of every input, after resynchronising the sequence:
+ *  - The queue drains and the step interrupt stops.
+ *  - No USB buffer is left held.
+ *
+ * The firmware is set up on the first input. Positions and calibration then
+ * carry over from one input to the next, as they would on the device, and
+ * fuzz_settle() leaves it idle for the next one. driver.cpp runs a failing
+ * input again in a fresh process to tell whether it fails alone. Failures
+ * abort.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hal.h>
+#include <usb.h>
+#include <commands.h>
+#include <segment.h>
+#include <motor.h>
+#include <crc.h>
+#include <machine.h>
+
+#define FUZZ_CTL_MS 		0x3f 			// Milliseconds to run after
+#define FUZZ_CTL_SEQ 		0x40 			// Sequence after seg_seq
+#define FUZZ_CTL_CRC 		0x80 			// Stamp a valid CRC
+
+#define FUZZ_TRAVEL_XY 		900
+#define FUZZ_TRAVEL_Z 		150
+
+#define fuzz_check(cond) 	((cond) ? (void)0 : fuzz_fail(#cond, __LINE__))
+
+static uint8_t fuzz_ready = 0;
+static uint8_t fuzz_pool = 0; 		// Buffers held while idle
+static uint8_t fuzz_last_cmd = 0; 	// Command of the newest packet written
+
+static void fuzz_fail(const char *what, int line)
+{
+	fprintf(stderr, "fuzz_cmd.cpp:%d: invariant failed: %s\n", line, what);
+	abort();
+}
+
+static void fuzz_stamp(uint8_t *buf)
+{
+	uint16_t crc = crc16(buf, SEG_CRC);
+
+	buf[SEG_CRC] = crc & 0xff;
+	buf[SEG_CRC + 1] = crc >> 8;
+}
+
+static void fuzz_host(void)
+{
+	uint8_t buf[BUF_SIZE];
+
+	while (sim_usb_read(buf))
+	{
+		fuzz_check(buf[USB_TRL_TYPE] <= USB_RPT_CREDITS);
+		fuzz_check(buf[USB_TRL_CREDITS] <= SEG_QUEUE_SIZE);
+
+		// Each packet is answered before the next is written.
+		if (buf[USB_TRL_TYPE] == USB_RPT_REPLY && fuzz_last_cmd == CMD_SEG)
+			fuzz_check(buf[SEG_RPL_STATUS] <= SEG_RANGE);
+	}
+}
+
+static void fuzz_invariants(void)
+{
+	mach_stats_t stats;
+
+	fuzz_check(seg_count() <= SEG_QUEUE_SIZE);
+	fuzz_check(seg_count() + seg_free() == SEG_QUEUE_SIZE);
+
+	mach_read(&stats);
+	fuzz_check(stats.stalls[X_AXIS] == 0 && stats.stalls[Y_AXIS] == 0);
+	fuzz_check(x_pos == (int)stats.pos[X_AXIS]);
+	fuzz_check(y_pos == (int)stats.pos[Y_AXIS]);
+}
+
+// Run the main loop for at least ms milliseconds and until the link is idle.
+static void fuzz_run(uint32_t ms)
+{
+	uint64_t until = sim_now() + (uint64_t)ms*SIM_TICK;
+
+	do
+	{
+		loop();
+		fuzz_host();
+		fuzz_invariants();
+	} while (sim_now() < until || sim_usb_backlog());
+}
+
+static void fuzz_packet(const uint8_t *buf, uint32_t ms)
+{
+	while (!sim_usb_write(buf))
+		fuzz_run(0);
+	fuzz_last_cmd = buf[0];
+	fuzz_run(ms);
+}
+
+static void fuzz_init(void)
+{
+	mach_config_t config;
+	uint8_t buf[BUF_SIZE] = {CMD_QRY, CMD_QRY_V};
+
+	memset(&config, 0, sizeof(config));
+	config.travel[X_AXIS] = config.travel[Y_AXIS] = FUZZ_TRAVEL_XY;
+	config.travel[Z_AXIS] = FUZZ_TRAVEL_Z;
+	config.start[Z_AXIS] = FUZZ_TRAVEL_Z/2 + 0.5;
+	mach_init(&config);
+	sim_host = fuzz_host;
+
+	// The firmware waits in setup() for the first packet.
+	sim_usb_write(buf);
+	setup();
+	fuzz_run(1);
+	fuzz_pool = usb_mem_stats(0)->in_use;
+	fuzz_ready = 1;
+}
+
+// Leave the firmware idle for the next input.
+static void fuzz_settle(void)
+{
+	uint8_t buf[BUF_SIZE];
+	const char *axis = "XYZ";
+
+	// Test modes off, partial G-code dropped, held packets freed.
+	for (; *axis; axis++)
+	{
+		memset(buf, 0, sizeof(buf));
+		buf[0] = CMD_HLT;
+		buf[1] = *axis;
+		fuzz_packet(buf, 0);
+	}
+	memset(buf, 0, sizeof(buf));
+	buf[0] = CMD_GCO;
+	fuzz_packet(buf, 0);
+	memset(buf, 0, sizeof(buf));
+	buf[0] = CMD_SEG;
+	buf[SEG_HDR_SEQ] = seg_seq;
+	fuzz_stamp(buf);
+	fuzz_packet(buf, 0);
+
+	// Only the step interrupt has work left, so the main loop, which it
+	// would wake on every tick, is left out until the queue is empty.
+	while (seg_moving())
+	{
+		sim_advance(SIM_TICK);
+		fuzz_invariants();
+	}
+	fuzz_run(0);
+	fuzz_check(seg_count() == 0);
+	fuzz_check(usb_mem_stats(0)->in_use == fuzz_pool);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t buf[BUF_SIZE], ctl;
+	size_t len;
+
+	if (!fuzz_ready)
+		fuzz_init();
+
+	while (size > 0)
+	{
+		ctl = data[0];
+		len = (size - 1 < BUF_SIZE) ? size - 1 : BUF_SIZE;
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, data + 1, len);
+		data += 1 + len;
+		size -= 1 + len;
+
+		if (ctl & FUZZ_CTL_SEQ)
+			buf[SEG_HDR_SEQ] = seg_seq + 1 + buf[SEG_HDR_SEQ] % (SEG_WINDOW + 1);
+		if (ctl & FUZZ_CTL_CRC)
+			fuzz_stamp(buf);
+		fuzz_packet(buf, ctl & FUZZ_CTL_MS);
+	}
+
+	fuzz_settle();
+
+	return 0;
+}
@@ -0,0 +1,697 @@
+/* Project: Ewaste 3D Printer
+ * Module: gcodec.cpp
+ * Functionality: Compiles G-code ahead of time into the compact segment
+ *                packets of the 'S' command
+ *
+ * Usage: gcodec [options] input.gcode output.bin
+ *  -x, -y, -z STEPS 	Calibrated travel of each axis in steps, as reported
+ * 						by the 'QC' query (default 900, 900, 150)
+ *  -X, -Y, -Z MM 		Travel of each axis in mm (default 37.5)
+ *  -f MM_PER_MIN 		Feed until the program sets one
+ *  -j THREADS 			Parser threads (default one per core)
+ *
+ * The output is a sequence of 64 byte packets, ready to be written to the
+ * device by motor.stream_file(). Sequence numbers start at one, and are
+ * restamped along with the CRC when sent.
+ *
+ * The file is split into chunks at line boundaries and the chunks are parsed
+ * in parallel. Lines are found with memchr(), which the C library vectorises.
+ * Modal state then has to be applied in order, so planning and encoding run
+ * on one thread over the parsed words. Consecutive collinear moves at the
+ * same feed are merged, and G2/G3 arcs are cut into chords that stay within
+ * half a step of the arc. Numbers are parsed into the same fixed point as
+ * the firmware interpreter, so both agree on every coordinate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <segment.h>
+#include <gcode.h>
+
+#define CMD_SEG 		'S' 	// Compact segment command
+#define PACKET_SEGS 	(SEG_QUEUE_SIZE / 2) 	// Leaves room to pipeline
+#define REPEAT_MAX 		16 		// Repetitions held in the flags byte
+
+#define MAX_X_DEFAULT 	900 	// Calibrated X travel in steps
+#define MAX_Y_DEFAULT 	900 	// Calibrated Y travel in steps
+#define MAX_Z_DEFAULT 	150 	// Calibrated Z travel in steps
+#define TRAVEL_DEFAULT 	37.5 	// Axis travel in mm
+
+#define NUM_AXES 		3
+
+// Words kept for each line
+enum
+{
+	GW_X, GW_Y, GW_Z, GW_F, GW_I, GW_J, GW_R, GW_COUNT
+};
+
+#define GW_SKIP 		0xff 	// Word that is parsed but not used
+#define GC_MAX 			4 		// G-codes kept per line
+
+typedef struct
+{
+	uint32_t lineno; 			// Line within its chunk, then the file
+	uint8_t seen; 				// GW_* bits present
+	uint8_t bad; 				// Malformed, skipped when planning
+	uint8_t ng; 				// G-codes on the line
+	uint16_t g[GC_MAX];
+	int32_t m; 					// M-code, or -1
+	int32_t val[GW_COUNT]; 		// Fixed point, GCODE_UNIT per unit
+} line_t;
+
+typedef struct
+{
+	const char *begin, *end;
+	std::vector<line_t> lines;
+	uint32_t nlines; 			// Newlines in the chunk
+} chunk_t;
+
+typedef struct
+{
+	int32_t d[NUM_AXES]; 		// Steps
+	uint16_t delay; 			// Microseconds per step
+} move_t;
+
+/*************************************************************************
+ * Parsing
+ *************************************************************************/
+
+static uint8_t word_index(char c)
+{
+	switch (c)
+	{
+		case 'X': return GW_X;
+		case 'Y': return GW_Y;
+		case 'Z': return GW_Z;
+		case 'F': return GW_F;
+		case 'I': return GW_I;
+		case 'J': return GW_J;
+		case 'R': return GW_R;
+	}
+	return GW_SKIP;
+}
+
+// Parse a number into fixed point, saturating like the firmware does.
+static const char *parse_number(const char *p, const char *end, int32_t *out)
+{
+	int32_t num = 0;
+	uint8_t neg = 0, digits = 0, frac = 0, point = 0;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+
+	for (; p < end; p++)
+	{
+		if (*p >= '0' && *p <= '9')
+		{
+			digits++;
+			if (point)
+			{
+				if (frac == GCODE_FRAC_DIGITS)
+					continue;
+				frac++;
+			}
+			if (num < GCODE_NUM_MAX / 10)
+				num = 10*num + (*p - '0');
+		}
+		else if (*p == '.' && !point)
+			point = 1;
+		else
+			break;
+	}
+
+	if (digits == 0)
+		return NULL;
+
+	for (; frac < GCODE_FRAC_DIGITS; frac++)
+		num = (num < GCODE_NUM_MAX / 10) ? 10*num : GCODE_NUM_MAX;
+	*out = neg ? -num : num;
+
+	return p;
+}
+
+static void parse_line(const char *p, const char *end, line_t *line)
+{
+	int32_t val;
+	uint8_t w;
+	char c;
+
+	line->seen = 0;
+	line->bad = 0;
+	line->ng = 0;
+	line->m = -1;
+
+	while (p < end)
+	{
+		c = *p++;
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+
+		if (c == ';' || c == '*')
+			return;
+		if (c == '(')
+		{
+			while (p < end && *p != ')')
+				p++;
+			p++;
+			continue;
+		}
+		if (c == ' ' || c == '\t' || c == '\r')
+			continue;
+		if (c < 'A' || c > 'Z')
+		{
+			line->bad = 1;
+			return;
+		}
+
+		p = parse_number(p, end, &val);
+		if (p == NULL)
+		{
+			line->bad = 1;
+			return;
+		}
+
+		if (c == 'G')
+		{
+			if (val % GCODE_UNIT || line->ng == GC_MAX)
+				line->bad = 1;
+			else
+				line->g[line->ng++] = val / GCODE_UNIT;
+		}
+		else if (c == 'M')
+			line->m = val / GCODE_UNIT;
+		else if ((w = word_index(c)) != GW_SKIP)
+		{
+			line->val[w] = val;
+			line->seen |= 1 << w;
+		}
+	}
+}
+
+static void parse_chunk(chunk_t *chunk)
+{
+	const char *p = chunk->begin, *nl;
+	line_t line;
+
+	chunk->nlines = 0;
+	while (p < chunk->end)
+	{
+		nl = (const char *)memchr(p, '\n', chunk->end - p);
+		if (nl == NULL)
+			nl = chunk->end;
+
+		parse_line(p, nl, &line);
+		if (line.seen || line.ng || line.m >= 0 || line.bad)
+		{
+			line.lineno = chunk->nlines;
+			chunk->lines.push_back(line);
+		}
+
+		chunk->nlines++;
+		p = nl + 1;
+	}
+}
+
+/*************************************************************************
+ * Planning
+ *************************************************************************/
+
+static double spm[NUM_AXES]; 				// Steps per mm
+static double feed = GCODE_FEED_DEFAULT / (double)GCODE_UNIT; 	// mm/min
+static uint8_t relative = 0, inches = 0;
+static double pos[NUM_AXES]; 				// Machine position, mm
+static double offset[NUM_AXES]; 			// Machine minus work position
+static int64_t steps[NUM_AXES]; 			// Machine position, steps
+static std::vector<move_t> moves;
+
+// Pending move, extended while the path stays straight
+static uint8_t pend = 0, pend_rapid;
+static double pend_from[NUM_AXES], pend_to[NUM_AXES], pend_feed;
+
+static double length(int32_t val)
+{
+	return val / (double)GCODE_UNIT * (inches ? GCODE_INCH / (double)GCODE_UNIT : 1.0);
+}
+
+// Half a step on the finest axis, used for merging and arcs.
+static double tolerance(void)
+{
+	return 0.5 / std::max(spm[GW_X], spm[GW_Y]);
+}
+
+static void emit(const double *to, uint8_t rapid, double f)
+{
+	long long target[NUM_AXES], delta[NUM_AXES], nsteps, largest, nparts, part;
+	double dist, delay;
+	move_t move;
+	int i;
+
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		target[i] = llround(to[i] * spm[i]);
+		delta[i] = target[i] - steps[i];
+	}
+
+	nsteps = std::max(llabs(delta[GW_X]), llabs(delta[GW_Y]));
+	largest = std::max(nsteps, llabs(delta[GW_Z]));
+	if (largest == 0)
+		return;
+
+	// Feed is along the XY path, or along Z for a plunge.
+	dist = hypot(to[GW_X] - pend_from[GW_X], to[GW_Y] - pend_from[GW_Y]);
+	if (dist == 0)
+		dist = fabs(to[GW_Z] - pend_from[GW_Z]);
+
+	delay = GCODE_RAPID_DELAY;
+	if (!rapid && nsteps)
+		delay = std::min(std::max(dist * 60e6 / f / nsteps,
+					(double)GCODE_MIN_DELAY), 65535.0);
+	move.delay = (uint16_t)delay;
+
+	nparts = largest / SEG_DELTA_MAX + 1;
+	for (part = 0; part < nparts; part++)
+	{
+		for (i = 0; i < NUM_AXES; i++)
+			move.d[i] = delta[i]*(part + 1)/nparts - delta[i]*part/nparts;
+		moves.push_back(move);
+	}
+
+	for (i = 0; i < NUM_AXES; i++)
+		steps[i] = target[i];
+}
+
+static void flush(void)
+{
+	if (pend)
+		emit(pend_to, pend_rapid, pend_feed);
+	pend = 0;
+}
+
+static void move_to(const double *to, uint8_t rapid)
+{
+	double a[NUM_AXES], b[NUM_AXES], cross[NUM_AXES], dot = 0, len2 = 0;
+	int i;
+
+	if (pend && pend_rapid == rapid && (rapid || pend_feed == feed))
+	{
+		// Merge if the previous end lies on the extended line, ahead.
+		for (i = 0; i < NUM_AXES; i++)
+		{
+			a[i] = pend_to[i] - pend_from[i];
+			b[i] = to[i] - pend_from[i];
+			dot += a[i] * (to[i] - pend_to[i]);
+			len2 += b[i] * b[i];
+		}
+		cross[0] = a[1]*b[2] - a[2]*b[1];
+		cross[1] = a[2]*b[0] - a[0]*b[2];
+		cross[2] = a[0]*b[1] - a[1]*b[0];
+
+		if (dot > 0 && len2 > 0 && (cross[0]*cross[0] + cross[1]*cross[1] +
+				cross[2]*cross[2]) / len2 < tolerance() * tolerance())
+		{
+			memcpy(pend_to, to, sizeof(pend_to));
+			memcpy(pos, to, sizeof(pos));
+			return;
+		}
+	}
+
+	flush();
+	pend = 1;
+	pend_rapid = rapid;
+	pend_feed = feed;
+	memcpy(pend_from, pos, sizeof(pend_from));
+	memcpy(pend_to, to, sizeof(pend_to));
+	memcpy(pos, to, sizeof(pos));
+}
+
+static void target_of(const line_t *line, double *to)
+{
+	int i;
+
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		to[i] = pos[i];
+		if (line->seen & (1 << i))
+			to[i] = length(line->val[i]) + (relative ? pos[i] : offset[i]);
+	}
+}
+
+static int arc(const line_t *line, uint8_t clockwise)
+{
+	double to[NUM_AXES], p[NUM_AXES], cx, cy, r, a0, a1, sweep, h, d, step;
+	int i, n, k;
+
+	target_of(line, to);
+
+	if (line->seen & (1 << GW_R))
+	{
+		// Centre on the bisector, a negative radius takes the long way.
+		r = length(line->val[GW_R]);
+		d = hypot(to[GW_X] - pos[GW_X], to[GW_Y] - pos[GW_Y]);
+		if (d == 0 || fabs(r) < d / 2)
+			return -1;
+		h = sqrt(r*r - d*d/4) / d;
+		if (clockwise == (r > 0))
+			h = -h;
+		cx = (pos[GW_X] + to[GW_X]) / 2 - h * (to[GW_Y] - pos[GW_Y]);
+		cy = (pos[GW_Y] + to[GW_Y]) / 2 + h * (to[GW_X] - pos[GW_X]);
+		r = fabs(r);
+	}
+	else
+	{
+		cx = pos[GW_X] + ((line->seen & (1 << GW_I)) ? length(line->val[GW_I]) : 0);
+		cy = pos[GW_Y] + ((line->seen & (1 << GW_J)) ? length(line->val[GW_J]) : 0);
+		r = hypot(pos[GW_X] - cx, pos[GW_Y] - cy);
+		if (r == 0)
+			return -1;
+	}
+
+	a0 = atan2(pos[GW_Y] - cy, pos[GW_X] - cx);
+	a1 = atan2(to[GW_Y] - cy, to[GW_X] - cx);
+	sweep = a1 - a0;
+	if (clockwise && sweep >= 0)
+		sweep -= 2*M_PI;
+	if (!clockwise && sweep <= 0)
+		sweep += 2*M_PI;
+
+	// Chord angle keeping the sagitta within tolerance.
+	step = (r > tolerance()) ? 2*acos(1 - tolerance() / r) : M_PI;
+	n = std::max(1, (int)ceil(fabs(sweep) / step));
+
+	memcpy(p, pos, sizeof(p));
+	for (k = 1; k <= n; k++)
+	{
+		if (k == n)
+			memcpy(p, to, sizeof(p));
+		else
+		{
+			p[GW_X] = cx + r*cos(a0 + sweep*k/n);
+			p[GW_Y] = cy + r*sin(a0 + sweep*k/n);
+			for (i = GW_Z; i < NUM_AXES; i++)
+				p[i] = pos[i] + (to[i] - pos[i]) / (n - k + 1);
+		}
+		move_to(p, 0);
+	}
+
+	return 0;
+}
+
+static int plan_line(const line_t *line)
+{
+	double to[NUM_AXES];
+	uint8_t i, k, motion = 0xff;
+
+	if (line->seen & (1 << GW_F) && line->val[GW_F] > 0)
+		feed = length(line->val[GW_F]);
+
+	if (line->m == 92)
+	{
+		// Steps per mm, in thousandths like every other number.
+		flush();
+		for (i = 0; i < NUM_AXES; i++)
+			if (line->seen & (1 << i) && line->val[i] > 0)
+				spm[i] = line->val[i] / (double)GCODE_UNIT;
+	}
+
+	for (k = 0; k < line->ng; k++)
+	{
+		switch (line->g[k])
+		{
+			case 20: inches = 1; break;
+			case 21: inches = 0; break;
+			case 90: relative = 0; break;
+			case 91: relative = 1; break;
+			case 0: case 1: case 2: case 3: case 28: case 92:
+				motion = line->g[k];
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	switch (motion)
+	{
+		case 0:
+		case 1:
+			target_of(line, to);
+			move_to(to, motion == 0);
+			break;
+
+		case 2:
+		case 3:
+			return arc(line, motion == 2);
+
+		case 28:
+			// Homing needs the switches, so return to the origin instead.
+			memset(to, 0, sizeof(to));
+			move_to(to, 1);
+			break;
+
+		case 92:
+			for (i = 0; i < NUM_AXES; i++)
+			{
+				if (line->seen & (1 << i))
+					offset[i] = pos[i] - length(line->val[i]);
+				else if ((line->seen & ((1 << NUM_AXES) - 1)) == 0)
+					offset[i] = pos[i];
+			}
+			break;
+	}
+
+	return 0;
+}
+
+/*************************************************************************
+ * Encoding, as segment.pack() on the host
+ *************************************************************************/
+
+static void varint(std::vector<uint8_t> &out, uint32_t val)
+{
+	while (val >= 0x80)
+	{
+		out.push_back((val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	out.push_back(val);
+}
+
+static void encode(std::vector<uint8_t> &out, const move_t *m, int reps, int with_feed)
+{
+	uint8_t flags = (reps - 1) << SEG_REPEAT_SHIFT;
+	size_t at = out.size();
+	int i;
+
+	out.push_back(0);
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		if (m->d[i] == 0)
+			continue;
+		flags |= SEG_FLAG_X << i;
+		varint(out, m->d[i] >= 0 ? (uint32_t)m->d[i] << 1 :
+				((uint32_t)-m->d[i] << 1) - 1);
+	}
+	if (with_feed)
+	{
+		flags |= SEG_FLAG_F;
+		varint(out, m->delay);
+	}
+	out[at] = flags;
+}
+
+static int same_move(const move_t *a, const move_t *b)
+{
+	return a->d[0] == b->d[0] && a->d[1] == b->d[1] && a->d[2] == b->d[2] &&
+		a->delay == b->delay;
+}
+
+static void write_packet(FILE *f, uint8_t seq, uint8_t nseg,
+		const std::vector<uint8_t> &body)
+{
+	uint8_t packet[SEG_PACKET_SIZE];
+	uint16_t crc;
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = CMD_SEG;
+	packet[SEG_HDR_SEQ] = seq;
+	packet[SEG_HDR_COUNT] = nseg;
+	memcpy(packet + SEG_HDR_SIZE, body.data(), body.size());
+
+	crc = crc16(packet, SEG_CRC);
+	packet[SEG_CRC] = crc & 0xff;
+	packet[SEG_CRC + 1] = crc >> 8;
+	fwrite(packet, 1, sizeof(packet), f);
+}
+
+static size_t pack(FILE *f)
+{
+	std::vector<uint8_t> body, seg;
+	size_t i, j, npackets = 0;
+	int reps, nseg = 0, largest;
+	int32_t last_feed = -1;
+
+	for (i = 0; i < moves.size(); i += reps)
+	{
+		// Identical moves go out once with a repeat count.
+		largest = std::max(std::max(abs(moves[i].d[0]), abs(moves[i].d[1])),
+				abs(moves[i].d[2]));
+		for (reps = 1, j = i + 1; j < moves.size() && reps < REPEAT_MAX &&
+				largest*(reps + 1) <= SEG_DELTA_MAX &&
+				same_move(&moves[j], &moves[i]); j++)
+			reps++;
+
+		seg.clear();
+		encode(seg, &moves[i], reps, moves[i].delay != last_feed);
+		if (SEG_HDR_SIZE + body.size() + seg.size() > SEG_CRC || nseg == PACKET_SEGS)
+		{
+			write_packet(f, ++npackets, nseg, body);
+			body.clear();
+			nseg = 0;
+
+			// Feed is resent in every packet so packets stand alone.
+			seg.clear();
+			encode(seg, &moves[i], reps, 1);
+		}
+
+		body.insert(body.end(), seg.begin(), seg.end());
+		last_feed = moves[i].delay;
+		nseg++;
+	}
+
+	if (nseg)
+	{
+		write_packet(f, ++npackets, nseg, body);
+	}
+
+	return npackets;
+}
+
+/*************************************************************************
+ * Driver
+ *************************************************************************/
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: gcodec [-x steps] [-y steps] [-z steps] [-X mm] "
+			"[-Y mm] [-Z mm] [-f mm/min] [-j threads] input.gcode output.bin\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	double max_steps[NUM_AXES] = {MAX_X_DEFAULT, MAX_Y_DEFAULT, MAX_Z_DEFAULT};
+	double travel[NUM_AXES] = {TRAVEL_DEFAULT, TRAVEL_DEFAULT, TRAVEL_DEFAULT};
+	unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<chunk_t> chunks;
+	std::vector<std::thread> threads;
+	std::vector<char> text;
+	const char *p, *end, *cut;
+	uint32_t lineno = 0, errors = 0, nlines = 0;
+	size_t npackets, k, len;
+	FILE *f;
+	int opt, i;
+
+	auto start = std::chrono::steady_clock::now();
+
+	while ((opt = getopt(argc, argv, "x:y:z:X:Y:Z:f:j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'x': max_steps[GW_X] = atof(optarg); break;
+			case 'y': max_steps[GW_Y] = atof(optarg); break;
+			case 'z': max_steps[GW_Z] = atof(optarg); break;
+			case 'X': travel[GW_X] = atof(optarg); break;
+			case 'Y': travel[GW_Y] = atof(optarg); break;
+			case 'Z': travel[GW_Z] = atof(optarg); break;
+			case 'f': feed = atof(optarg); break;
+			case 'j': nthreads = std::max(1, atoi(optarg)); break;
+			default: usage();
+		}
+	}
+	if (argc - optind != 2)
+		usage();
+
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		if (max_steps[i] <= 0 || travel[i] <= 0)
+			usage();
+		spm[i] = max_steps[i] / travel[i];
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (f == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	text.resize(ftell(f));
+	fseek(f, 0, SEEK_SET);
+	len = fread(text.data(), 1, text.size(), f);
+	fclose(f);
+
+	// Cut into chunks that end on a newline.
+	p = text.data();
+	end = p + len;
+	chunks.resize(nthreads);
+	for (k = 0; k < nthreads; k++)
+	{
+		cut = (k == nthreads - 1) ? end : p + (end - p) / (nthreads - k);
+		if (cut < end)
+		{
+			cut = (const char *)memchr(cut, '\n', end - cut);
+			cut = cut ? cut + 1 : end;
+		}
+		chunks[k].begin = p;
+		chunks[k].end = cut;
+		p = cut;
+	}
+
+	for (k = 0; k < nthreads; k++)
+		threads.push_back(std::thread(parse_chunk, &chunks[k]));
+	for (k = 0; k < nthreads; k++)
+		threads[k].join();
+
+	for (k = 0; k < nthreads; k++)
+	{
+		for (line_t &line : chunks[k].lines)
+		{
+			if (line.bad || plan_line(&line) < 0)
+			{
+				fprintf(stderr, "%s:%u: skipped\n", argv[optind],
+						lineno + line.lineno + 1);
+				errors++;
+			}
+			nlines++;
+		}
+		lineno += chunks[k].nlines;
+	}
+	flush();
+
+	f = fopen(argv[optind + 1], "wb");
+	if (f == NULL)
+	{
+		perror(argv[optind + 1]);
+		return 1;
+	}
+	npackets = pack(f);
+	fclose(f);
+
+	fprintf(stderr, "%u lines, %u skipped, %zu segments, %zu packets, "
+			"%.1f ms\n", nlines, errors, moves.size(), npackets,
+			std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count());
+
+	return errors ? 2 : 0;
+}
@@ -0,0 +1,194 @@
+#!/usr/bin/env python
+
+'''
+Project: Ewaste 3D Printer
+Module: link.py
+Functionality: Opens the printer over either USB transport and measures link
+               throughput.
+
+Notes:
+    1. Firmware built with -DUSB_RAWHID or -DUSB_RAWHID_SERIAL is opened
+       with the hid module, firmware built with -DUSB_VENDOR is opened with
+       pyusb. Both return an object with the write() and read() calls
+       motor.py expects, so assigning it to motor.dev is all that is needed.
+    2. RawHID moves at most one 64 byte report per millisecond in each
+       direction. The bulk endpoints are not polled on an interval and can
+       carry several packets per frame.
+    3. open_sim() runs the host build of the firmware (make host) in place
+       of a printer, with packets over its stdin and stdout.
+    4. Running this module compares the two transports on whichever one is
+       plugged in.
+'''
+
+# System imports
+import os
+import select
+import subprocess
+import sys
+import time
+
+# Custom imports
+import motor
+import segment
+
+# Communication constants
+IDPRODUCT_VENDOR    = 0x05DC    # Product ID of the vendor bulk firmware
+IDPRODUCT_SERIAL    = 0x048C    # Product ID of the RawHID and serial firmware
+ENDPOINT_OUT        = 0x04      # Bulk OUT endpoint
+ENDPOINT_IN         = 0x83      # Bulk IN endpoint
+WINDOW              = 4         # Requests in flight while measuring
+HOSTFW              = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                   '..', 'sim', 'hostfw')
+
+class BulkDevice(object):
+    '''
+        Wrapper around a pyusb device with the hid module's read and write.
+    '''
+    def __init__(self, dev):
+        self.dev = dev
+
+    def write(self, data):
+        data = bytearray(data)
+        data += bytearray(motor.NBYTES - len(data))
+        return self.dev.write(ENDPOINT_OUT, data)
+
+    def read(self, nbytes, timeout):
+        try:
+            return self.dev.read(ENDPOINT_IN, nbytes, timeout or 0).tolist()
+        except Exception:
+            return []
+
+class SimDevice(object):
+    '''
+        Wrapper around the host build of the firmware with the hid module's
+        read and write.
+    '''
+    def __init__(self, proc):
+        self.proc = proc
+
+    def write(self, data):
+        if not isinstance(data, (bytes, bytearray, list)):
+            data = data.encode('latin-1')
+        data = bytearray(data)
+        data += bytearray(motor.NBYTES - len(data))
+        self.proc.stdin.write(bytes(data))
+        self.proc.stdin.flush()
+        return len(data)
+
+    def read(self, nbytes, timeout):
+        out = self.proc.stdout
+        if timeout and not select.select([out], [], [], timeout/1000.0)[0]:
+            return []
+        return list(bytearray(out.read(nbytes)))
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+def open_sim(fast=False):
+    '''
+        Function to start the host build of the firmware.
+
+        Inputs:
+            fast: Run the simulated clock as fast as possible rather than in
+                  real time.
+
+        Outputs:
+            dev: Device handle, or None if it is not built.
+    '''
+    if not os.path.exists(HOSTFW):
+        return None
+
+    proc = subprocess.Popen([HOSTFW] + (['-f'] if fast else []),
+                            stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            bufsize=0)
+
+    return SimDevice(proc)
+
+def open_rawhid():
+    '''
+        Function to open the RawHID firmware.
+
+        Inputs:
+            None.
+
+        Outputs:
+            dev: Device handle, or None if not found.
+    '''
+    import hid
+
+    for product in [motor.IDPRODUCT, IDPRODUCT_SERIAL]:
+        dev = hid.device()
+        try:
+            dev.open(motor.IDVENDOR, product)
+        except IOError:
+            continue
+        return dev
+
+    return None
+
+def open_bulk():
+    '''
+        Function to open the vendor bulk firmware.
+
+        Inputs:
+            None.
+
+        Outputs:
+            dev: Device handle, or None if not found.
+    '''
+    import usb.core
+
+    dev = usb.core.find(idVendor=motor.IDVENDOR, idProduct=IDPRODUCT_VENDOR)
+    if dev is None:
+        return None
+    dev.set_configuration()
+
+    return BulkDevice(dev)
+
+def throughput(dev, npackets=2000):
+    '''
+        Function to measure round trips through the command path. Empty
+        segment packets are sent with a few in flight, and each one is
+        answered with a reply.
+
+        Inputs:
+            dev: Device handle.
+            npackets: Number of packets to send.
+
+        Outputs:
+            rate: Packets per second in each direction.
+            kbps: Kilobytes per second in each direction.
+    '''
+    packet = segment.frame(0, 0, [])
+
+    begin = time.time()
+    inflight = 0
+    for idx in range(npackets):
+        dev.write(packet)
+        inflight += 1
+        if inflight == WINDOW:
+            dev.read(motor.NBYTES, motor.TIMEOUT_READ)
+            inflight -= 1
+    while inflight:
+        dev.read(motor.NBYTES, motor.TIMEOUT_READ)
+        inflight -= 1
+    elapsed = time.time() - begin
+
+    rate = npackets/elapsed
+
+    return rate, rate*motor.NBYTES/1024.0
+
+if __name__ == '__main__':
+    for name, opener in [('rawhid', open_rawhid), ('bulk', open_bulk),
+                         ('sim', open_sim)]:
+        try:
+            dev = opener()
+        except ImportError:
+            dev = None
+        if dev is None:
+            print('%-8s not connected' % name)
+            continue
+        rate, kbps = throughput(dev)
+        print('%-8s %7.0f packets/s %7.1f KB/s' % (name, rate, kbps))
+        sys.stdout.flush()
@@ -13,9 +13,18 @@ import sys
 import time
 import cPickle
 
+# Custom imports
+import segment
+
 # Global variable dev.
 dev = None
 
+# Sequence number of the next segment packet
+seq = 0
+
+# Latest telemetry report, see read_telemetry()
+telemetry = dict()
+
 # Communication constants
 IDVENDOR        = 0x16c0    # USB device vendor ID
 IDPRODUCT       = 0x0486    # USB device product ID
@@ -39,6 +48,22 @@ MOTOR_SW1_ON    = 2         # Switch 1 is on
 MOTOR_SW2_ON    = 1         # Switch 2 is on
 DIR1            = 0         # Direction towards switch 1
 DIR2            = 1         # Direction towards switch 2
+TRL_TYPE        = NBYTES-3  # Report type in the trailer
+RPT_REPLY       = 0         # Reply to a command
+RPT_TELEMETRY   = 1         # Unsolicited telemetry report
+RPT_CREDITS     = 2         # Motion queue drained, trailer only
+TIMEOUT_CREDITS = 200       # Wait for a credits report before polling
+TRACE_STEP      = 0         # Step interrupt running the motion queue
+TRACE_ENC       = 1         # Z encoder edge
+TRACE_POS       = 2         # Z position polling
+TRACE_USB       = 3         # USB interrupt
+TRACE_BUCKETS   = 16        # Histogram buckets
+TRACE_HIST_SHIFT = 4        # First bucket starts at 16 cycles
+CAP_TRACE       = 0x08      # Firmware built with -DTRACE
+JIT_X           = 0         # Step jitter of the X axis
+JIT_Y           = 1         # Step jitter of the Y axis
+CMD_GCODE       = ord('G')  # G-code text command
+GCODE_CHUNK     = NBYTES-2  # Text bytes per G-code packet
 
 def steps_calibrate():
     '''
@@ -72,7 +97,7 @@ def _steps_calibrate(axis):
     dev.write('C'+axis)
     time.sleep(2)
     dev.write('QC')
-    t = dev.read(NBYTES, None)
+    t = _read(None)
 
     return 256*ord(t[1]) + ord(t[0])
 
@@ -89,7 +114,7 @@ def get_position():
             zpos: Z axis position with respect to switch 1.
     '''
     dev.write('QP')
-    t = dev.read(NBYTES, TIMEOUT_READ)
+    t = _read()
 
     xpos = ord(t[0]) + ord(t[1])*256
     ypos = ord(t[2]) + ord(t[3])*256
@@ -112,10 +137,203 @@ def get_status():
 
     dev.write('QS')
 
-    t = dev.read(NBYTES, TIMEOUT_READ)
+    t = _read()
 
     return [ord(t[0]), ord(t[1]), ord(t[2])]
 
+def get_capabilities():
+    '''
+        Function to get the protocol version and supported commands.
+
+        Inputs:
+            None.
+
+        Outputs:
+            caps: Dictionary with the version, motion queue size, build
+                  features and, per command letter, its payload length,
+                  reply length and flags.
+    '''
+    dev.write('QV')
+    t = bytearray(_read())
+
+    caps = dict()
+    caps['version'] = (t[0], t[1])
+    caps['queue'] = t[2]
+    caps['features'] = t[3]
+    caps['commands'] = dict()
+    for idx in range(t[4]):
+        entry = t[5 + 4*idx:9 + 4*idx]
+        caps['commands'][chr(entry[0])] = (entry[1], entry[2], entry[3])
+
+    return caps
+
+def get_usb_stats(clear=False):
+    '''
+        Function to get usage of the firmware's USB buffer pool, to size
+        it for streaming. Endpoint 0 counts receive buffers.
+
+        Inputs:
+            clear: Restart the counters after reading them.
+
+        Outputs:
+            stats: Dictionary with the pool size, receive reserve, buffers
+                   in use, high water mark, allocations and failures, and
+                   per endpoint a dictionary of in use, high water, quota
+                   and failures.
+    '''
+    dev.write(bytes(bytearray([ord('Q'), ord('U'), 1 if clear else 0])))
+    t = bytearray(_read())
+
+    stats = dict()
+    stats['size'] = t[0]
+    stats['reserve'] = t[1]
+    stats['in_use'] = t[2]
+    stats['high_water'] = t[3]
+    stats['allocs'] = t[4] + (t[5] << 8) + (t[6] << 16) + (t[7] << 24)
+    stats['fails'] = t[8] + (t[9] << 8) + (t[10] << 16) + (t[11] << 24)
+    stats['endpoints'] = dict()
+    for ep in range(t[12]):
+        entry = t[13 + 5*ep:18 + 5*ep]
+        stats['endpoints'][ep] = {'in_use': entry[0], 'high_water': entry[1],
+                                  'quota': entry[2],
+                                  'fails': entry[3] + (entry[4] << 8)}
+
+    return stats
+
+def get_isr_stats(clear=False):
+    '''
+        Function to get how many segment packets the firmware decoded in its
+        USB interrupt, for firmware built with -DSEG_ISR, and how long that
+        took.
+
+        Inputs:
+            clear: Restart the counters after reading them.
+
+        Outputs:
+            stats: Dictionary with packets handled in the interrupt, packets
+                   left to the main loop, and the last and longest time
+                   spent on one packet in microseconds.
+    '''
+    dev.write(bytes(bytearray([ord('Q'), ord('I'), 1 if clear else 0])))
+    t = bytearray(_read())
+
+    stats = dict()
+    stats['handled'] = t[0] + (t[1] << 8) + (t[2] << 16) + (t[3] << 24)
+    stats['deferred'] = t[4] + (t[5] << 8) + (t[6] << 16) + (t[7] << 24)
+    stats['last_us'] = (t[8] + (t[9] << 8) + (t[10] << 16) +
+                        (t[11] << 24))/1000.0
+    stats['max_us'] = (t[12] + (t[13] << 8) + (t[14] << 16) +
+                       (t[15] << 24))/1000.0
+
+    return stats
+
+def get_load():
+    '''
+        Function to get how busy the firmware main loop has been since the
+        last call. The rest of the time it sleeps waiting for interrupts,
+        and is free for planning.
+
+        Inputs:
+            None.
+
+        Outputs:
+            load: Dictionary with the fraction of time awake, the window in
+                  seconds and the number of interrupts that woke the loop.
+    '''
+    dev.write('QL')
+    t = bytearray(_read())
+
+    load = dict()
+    load['busy'] = (t[0] + (t[1] << 8))/1000.0
+    load['window'] = (t[2] + (t[3] << 8) + (t[4] << 16) +
+                      (t[5] << 24))/1e6
+    load['wakes'] = t[6] + (t[7] << 8) + (t[8] << 16) + (t[9] << 24)
+
+    return load
+
+def get_trace_stats(source, clear=False):
+    '''
+        Function to get timing statistics of one interrupt handler, for
+        firmware built with -DTRACE.
+
+        Inputs:
+            source: Handler number, one of the TRACE_* constants.
+            clear: Restart the statistics of every handler after reading.
+
+        Outputs:
+            stats: Dictionary with the number of records, the shortest,
+                   longest and average in microseconds, and the histogram
+                   as a list of (lowest microseconds, count).
+    '''
+    dev.write(bytes(bytearray([ord('Q'), ord('T'), source, 1 if clear else 0])))
+    t = bytearray(_read())
+
+    mhz = float(t[16])
+    stats = dict()
+    stats['count'] = t[0] + (t[1] << 8) + (t[2] << 16) + (t[3] << 24)
+    stats['min_us'] = (t[4] + (t[5] << 8) + (t[6] << 16) + (t[7] << 24))/mhz
+    stats['max_us'] = (t[8] + (t[9] << 8) + (t[10] << 16) + (t[11] << 24))/mhz
+    stats['avg_us'] = (t[12] + (t[13] << 8) + (t[14] << 16) +
+                       (t[15] << 24))/mhz
+    stats['hist'] = [((1 << (idx + TRACE_HIST_SHIFT))/mhz if idx else 0,
+                      t[17 + 2*idx] + (t[18 + 2*idx] << 8))
+                     for idx in range(TRACE_BUCKETS)]
+
+    return stats
+
+def get_jitter(axis, clear=False):
+    '''
+        Function to get how late the step edges of one axis came against the
+        step timer.
+
+        Inputs:
+            axis: JIT_X or JIT_Y.
+            clear: Restart the statistics of both axes after reading.
+
+        Outputs:
+            stats: Dictionary with the number of edges, the edges a whole
+                   step period or more late, the latest edge in
+                   microseconds, and the histogram as a list of (lowest
+                   microseconds, count).
+    '''
+    dev.write(bytes(bytearray([ord('Q'), ord('J'), axis, 1 if clear else 0])))
+    t = bytearray(_read())
+
+    mhz = float(t[12])
+    stats = dict()
+    stats['steps'] = t[0] + (t[1] << 8) + (t[2] << 16) + (t[3] << 24)
+    stats['misses'] = t[4] + (t[5] << 8) + (t[6] << 16) + (t[7] << 24)
+    stats['max_us'] = (t[8] + (t[9] << 8) + (t[10] << 16) + (t[11] << 24))/mhz
+    stats['hist'] = [((1 << (idx + TRACE_HIST_SHIFT))/mhz if idx else 0,
+                      t[13 + 2*idx] + (t[14 + 2*idx] << 8))
+                     for idx in range(TRACE_BUCKETS)]
+
+    return stats
+
+def get_trace(source):
+    '''
+        Function to get the latest trace records of one interrupt handler,
+        for firmware built with -DTRACE.
+
+        Inputs:
+            source: Handler number, one of the TRACE_* constants.
+
+        Outputs:
+            records: List of (entry, length) in microseconds, oldest first.
+                     Entry times wrap with the 32 bit cycle counter.
+    '''
+    dev.write(bytes(bytearray([ord('Q'), ord('R'), source, 0])))
+    t = bytearray(_read())
+
+    mhz = float(t[1])
+    records = []
+    for idx in range(t[0]):
+        r = t[2 + 8*idx:10 + 8*idx]
+        records.append(((r[0] + (r[1] << 8) + (r[2] << 16) + (r[3] << 24))/mhz,
+                        (r[4] + (r[5] << 8) + (r[6] << 16) + (r[7] << 24))/mhz))
+
+    return records
+
 def move(axis, nsteps, direction, delay=0.1):
     '''
         Function to move a motor axis for a given number of steps.
@@ -214,6 +432,271 @@ def reset(delay=0.001):
     pos['Y'] = 0
     pos['Z'] = 0
 
+def _read(timeout=TIMEOUT_READ, credits=False):
+    '''
+        Function to read the next command reply. Telemetry reports that
+        arrive in between are decoded into the telemetry dictionary.
+
+        Inputs:
+            timeout: Read timeout in milliseconds.
+            credits: Return credits reports as well, instead of skipping
+                     them.
+
+        Outputs:
+            t: Reply as returned by the HID device.
+    '''
+    while True:
+        t = dev.read(NBYTES, timeout)
+        if not t:
+            return t
+        rtype = bytearray(t)[TRL_TYPE]
+        if rtype == RPT_TELEMETRY:
+            decode_telemetry(bytearray(t))
+        elif rtype != RPT_CREDITS or credits:
+            return t
+
+def decode_telemetry(t):
+    '''
+        Function to decode a telemetry report.
+
+        Inputs:
+            t: Report bytes.
+
+        Outputs:
+            None.
+    '''
+    def s16(lo, hi):
+        val = lo + 256*hi
+        return val - 65536 if val >= 32768 else val
+
+    telemetry['X'] = t[0] + 256*t[1]
+    telemetry['Y'] = t[2] + 256*t[3]
+    telemetry['Z'] = t[4] + 256*t[5]
+    telemetry['Zerr'] = s16(t[6], t[7])
+    telemetry['state'] = [t[8], t[9], t[10]]
+    telemetry['queue'] = t[11]
+    telemetry['time'] = t[12] + (t[13] << 8) + (t[14] << 16) + (t[15] << 24)
+
+def set_telemetry(period):
+    '''
+        Function to set how often the firmware pushes telemetry.
+
+        Inputs:
+            period: Milliseconds between reports, 0 to stop them.
+
+        Outputs:
+            None.
+    '''
+    dev.write('R'+chr(period & 0xff)+chr((period >> 8) & 0xff))
+
+def read_telemetry(timeout=TIMEOUT_READ):
+    '''
+        Function to wait for the next telemetry report.
+
+        Inputs:
+            timeout: Read timeout in milliseconds.
+
+        Outputs:
+            telemetry: Dictionary with positions, switch states, queue depth,
+                       Z error and device time.
+    '''
+    while True:
+        t = bytearray(dev.read(NBYTES, timeout))
+        if not t:
+            return telemetry
+        if t[TRL_TYPE] == RPT_TELEMETRY:
+            decode_telemetry(t)
+            return telemetry
+
+def _reply():
+    '''
+        Function to read a reply and its flow control trailer.
+
+        Inputs:
+            None.
+
+        Outputs:
+            t: Reply bytes.
+            credits: Free motion queue slots on the device.
+    '''
+    t = bytearray(_read())
+
+    return t, t[segment.TRL_CREDITS]
+
+def sync():
+    '''
+        Function to restart the segment sequence numbers.
+
+        Inputs:
+            None.
+
+        Outputs:
+            credits: Free motion queue slots on the device.
+    '''
+    dev.write(segment.frame(seq, 0, []))
+    t, credits = _reply()
+
+    return credits
+
+def stream(segments, feed=None):
+    '''
+        Function to stream motion segments, keeping the device queue full.
+        Each packet costs as many credits as it has segments, and every
+        reply tells how many queue slots are free after that packet.
+
+        Inputs:
+            segments: List of (dx, dy, dz, feed) tuples.
+            feed: Feed already known to the firmware, if any.
+
+        Outputs:
+            None.
+    '''
+    packets, counts = segment.pack(segments, feed)
+    _send(packets, counts)
+
+def stream_file(name):
+    '''
+        Function to stream a file of packets compiled by host/gcodec.
+
+        Inputs:
+            name: Path of the compiled file.
+
+        Outputs:
+            None.
+    '''
+    data = open(name, 'rb').read()
+    packets = [data[idx:idx + NBYTES] for idx in range(0, len(data), NBYTES)]
+    counts = [bytearray(p)[2] for p in packets]
+
+    _send(packets, counts)
+
+def _send(packets, counts):
+    '''
+        Function to send segment packets, keeping the device queue full.
+        Sequence numbers are restamped to follow on from the last stream.
+        The firmware holds packets that arrive ahead of a damaged or lost
+        one, so only that packet is sent again.
+
+        Inputs:
+            packets: List of 'S' packets.
+            counts: Number of segments carried by each packet.
+
+        Outputs:
+            None.
+    '''
+    global seq
+
+    credits = sync()
+    base = seq + 1
+    packets = [segment.restamp(p, base + idx) for idx, p in enumerate(packets)]
+
+    acked = 0           # Packets queued by the device
+    idx = 0             # Next packet not yet sent
+    sends = []          # Packet index of each write awaiting a reply
+    latest = dict()     # Write number of the newest copy of each packet
+    nsend = 0           # Writes so far
+
+    while acked < len(packets):
+        pending = sum(counts[acked:idx])
+
+        # Send while the device has room and can hold the packet.
+        if (idx < len(packets) and idx - acked < segment.SEG_WINDOW and
+                counts[idx] <= credits - pending):
+            dev.write(packets[idx])
+            sends.append((idx, nsend))
+            latest[idx] = nsend
+            nsend += 1
+            idx += 1
+            continue
+
+        # Nothing in flight, so wait for the report the device sends as its
+        # queue drains, and poll for credits if none comes.
+        if not sends:
+            t = bytearray(_read(TIMEOUT_CREDITS, credits=True))
+            if t:
+                credits = t[segment.TRL_CREDITS]
+                continue
+            dev.write('QS')
+            sends.append((None, nsend))
+            nsend += 1
+
+        t = bytearray(_read())
+        if not t:
+            # Lost replies, send everything not yet queued again.
+            sends = []
+            for k in range(acked, idx):
+                dev.write(packets[k])
+                sends.append((k, nsend))
+                latest[k] = nsend
+                nsend += 1
+            continue
+
+        # The trailer acknowledges everything queued so far.
+        credits = t[segment.TRL_CREDITS]
+        delta = (t[segment.TRL_SEQ] - (base - 1 + acked)) & 0xff
+        if delta <= idx - acked:
+            acked += delta
+
+        # Replies come in the order of the writes.
+        k, number = sends.pop(0)
+        if k is None:
+            continue
+        while sends and t[1] != (base + k) & 0xff and t[0] != segment.SEG_BAD_CRC:
+            k, number = sends.pop(0)
+
+        if t[0] == segment.SEG_RANGE:
+            raise ValueError('packet %d has a delta out of range' % k)
+        if t[0] in [segment.SEG_BAD_CRC, segment.SEG_ORDER]:
+            missing = k
+        elif t[0] == segment.SEG_GAP:
+            missing = acked
+        else:
+            continue
+
+        # Resend unless a newer copy is already on its way.
+        if acked <= missing < idx and latest[missing] <= number:
+            dev.write(packets[missing])
+            sends.append((missing, nsend))
+            latest[missing] = nsend
+            nsend += 1
+
+    seq = (base - 1 + len(packets)) & 0xff
+
+def gcode(text):
+    '''
+        Function to send G-code text to the firmware interpreter. The text is
+        cut into packets regardless of line boundaries. The firmware answers
+        each packet once its moves are queued, so a full queue holds up the
+        next packet.
+
+        Inputs:
+            text: G-code program as a string.
+
+        Outputs:
+            errors: List of (lines, error), with the line count after each
+                    packet holding a refused line.
+            lines: Number of lines executed by the firmware.
+    '''
+    errors = []
+    lines = 0
+    data = bytearray(text.encode('ascii', 'replace'))
+    if data[-1:] != bytearray(b'\n'):
+        data += bytearray(b'\n')
+
+    for idx in range(0, len(data), GCODE_CHUNK):
+        chunk = data[idx:idx + GCODE_CHUNK]
+        dev.write(bytes(bytearray([CMD_GCODE, len(chunk)]) + chunk))
+
+        # Replies wait for queue space, so keep waiting while moves run.
+        t = bytearray()
+        while not t:
+            t = bytearray(_read())
+        lines = t[1] + 256*t[2]
+        if t[0]:
+            errors.append((lines, t[0]))
+
+    return errors, lines
+
 def movexy(xsteps, ysteps, delay=0.01):
     '''
         Function to move the XY stage for a given x steps and y steps.
@@ -0,0 +1,299 @@
+#!/usr/bin/env python
+
+'''
+Project: Ewaste 3D Printer
+Module: segment.py
+Functionality: Encodes motion into the compact segment packets understood by
+               the firmware's 'S' command.
+
+Notes:
+    1. Each segment is a flags byte followed by zig-zag varint deltas for the
+       axes that moved and an optional varint feed (microseconds per step).
+    2. Identical consecutive segments are sent once with a repeat count in
+       the high nibble of the flags byte.
+    3. Every packet ends with a CRC-16/CCITT-FALSE of the bytes before it,
+       so the firmware can ask for just the damaged packet again.
+    4. Running this module prints segments per packet for a few reference
+       plots, compared against the one-step-per-packet 'M' command.
+'''
+
+# System imports
+import math
+
+# Communication constants
+NBYTES          = 64        # Size of a HID report
+CMD_SEG         = ord('S')  # Compact segment command
+HDR_SIZE        = 3         # Command byte, sequence and segment count
+CRC_SIZE        = 2         # CRC at the end of each packet
+CRC_POLY        = 0x1021    # CRC-16/CCITT-FALSE polynomial
+CRC_INIT        = 0xFFFF    # CRC-16/CCITT-FALSE initial value
+
+# Constants from firmware
+SEG_FLAG_X      = 0x01      # X delta present
+SEG_FLAG_Y      = 0x02      # Y delta present
+SEG_FLAG_Z      = 0x04      # Z delta present
+SEG_FLAG_F      = 0x08      # Feed present
+SEG_REPEAT_MAX  = 15        # Extra repetitions held in the high nibble
+SEG_DELTA_MAX   = 32767     # Largest delta after repetition
+SEG_QUEUE_SIZE  = 64        # Motion queue slots
+SEG_PACKET_MAX  = SEG_QUEUE_SIZE//2 # Segments per packet, leaves room to pipeline
+SEG_WINDOW      = 4         # Packets the firmware holds ahead of the queue
+SEG_OK          = 0         # Packet queued, or queued before
+SEG_HELD        = 1         # Held for earlier packets or credits
+SEG_ORDER       = 2         # Outside the window, dropped
+SEG_BAD_CRC     = 3         # CRC mismatch, dropped
+SEG_GAP         = 4         # Held, the packet in reply byte 2 never arrived
+SEG_RANGE       = 5         # A delta overflows SEG_DELTA_MAX, dropped
+TRL_SEQ         = NBYTES-2  # Reply offset of last accepted sequence
+TRL_CREDITS     = NBYTES-1  # Reply offset of free queue slots
+
+def _crc_table():
+    '''
+        Function to build the byte-wise CRC table.
+
+        Inputs:
+            None.
+
+        Outputs:
+            table: List of 256 CRC values.
+    '''
+    table = []
+    for idx in range(256):
+        crc = idx << 8
+        for bit in range(8):
+            crc = ((crc << 1) ^ CRC_POLY) if crc & 0x8000 else (crc << 1)
+        table.append(crc & 0xffff)
+
+    return table
+
+CRC_TABLE = _crc_table()
+
+def crc16(data):
+    '''
+        Function to compute the packet CRC.
+
+        Inputs:
+            data: Bytes to check, as a bytearray or list.
+
+        Outputs:
+            crc: 16 bit CRC.
+    '''
+    crc = CRC_INIT
+    for b in data:
+        crc = ((crc << 8) & 0xffff) ^ CRC_TABLE[(crc >> 8) ^ b]
+
+    return crc
+
+def zigzag(val):
+    '''
+        Function to map a signed integer onto an unsigned one so that small
+        magnitudes of either sign encode to short varints.
+
+        Inputs:
+            val: Signed integer.
+
+        Outputs:
+            zval: Zig-zag mapped unsigned integer.
+    '''
+    if val >= 0:
+        return val << 1
+    return ((-val) << 1) - 1
+
+def varint(val):
+    '''
+        Function to encode an unsigned integer as a little endian base 128
+        varint.
+
+        Inputs:
+            val: Unsigned integer.
+
+        Outputs:
+            data: List of encoded bytes.
+    '''
+    data = []
+    while val >= 0x80:
+        data.append((val & 0x7f) | 0x80)
+        val >>= 7
+    data.append(val)
+
+    return data
+
+def encode_segment(seg, reps, feed):
+    '''
+        Function to encode a single segment.
+
+        Inputs:
+            seg: 3-tuple of X, Y and Z deltas in steps.
+            reps: Number of times the segment is repeated, 1 to 16.
+            feed: Step interval in microseconds, or None to reuse the last.
+
+        Outputs:
+            data: List of encoded bytes.
+    '''
+    flags = (reps - 1) << 4
+    data = []
+
+    for idx, bit in enumerate([SEG_FLAG_X, SEG_FLAG_Y, SEG_FLAG_Z]):
+        if seg[idx] != 0:
+            flags |= bit
+            data += varint(zigzag(seg[idx]))
+
+    if feed is not None:
+        flags |= SEG_FLAG_F
+        data += varint(feed)
+
+    return [flags] + data
+
+def run_length(segments):
+    '''
+        Function to collapse identical consecutive segments.
+
+        Inputs:
+            segments: List of (dx, dy, dz, feed) tuples.
+
+        Outputs:
+            runs: List of ((dx, dy, dz, feed), reps) tuples.
+    '''
+    runs = []
+    for seg in segments:
+        if runs:
+            prev, reps = runs[-1]
+            largest = max([abs(i) for i in seg[:3]])
+            if (prev == seg and reps <= SEG_REPEAT_MAX and
+                    largest*(reps + 1) <= SEG_DELTA_MAX):
+                runs[-1] = (prev, reps + 1)
+                continue
+        runs.append((seg, 1))
+
+    return runs
+
+def pack(segments, feed=None, seq=0):
+    '''
+        Function to pack segments into 64 byte 'S' command packets.
+
+        Inputs:
+            segments: List of (dx, dy, dz, feed) tuples.
+            feed: Feed already known to the firmware, if any.
+            seq: Sequence number of the first packet.
+
+        Outputs:
+            packets: List of packets, each a string of NBYTES bytes.
+            counts: Number of segments carried by each packet.
+    '''
+    packets = []
+    counts = []
+    body = []
+    nseg = 0
+
+    for seg, reps in run_length(segments):
+        data = encode_segment(seg[:3], reps, None if seg[3] == feed else seg[3])
+
+        # Close the packet if this segment does not fit.
+        if (HDR_SIZE + len(body) + len(data) > NBYTES - CRC_SIZE or
+                nseg == SEG_PACKET_MAX):
+            packets.append(frame(seq + len(packets), nseg, body))
+            counts.append(nseg)
+            body = []
+            nseg = 0
+
+            # Feed is resent in every packet so packets stand alone.
+            data = encode_segment(seg[:3], reps, seg[3])
+
+        body += data
+        nseg += 1
+        feed = seg[3]
+
+    if nseg:
+        packets.append(frame(seq + len(packets), nseg, body))
+        counts.append(nseg)
+
+    return packets, counts
+
+def frame(seq, nseg, body):
+    '''
+        Function to frame a packet body. A packet with no segments
+        resynchronises the sequence number.
+
+        Inputs:
+            seq: Sequence number, taken modulo 256.
+            nseg: Number of segments in the body.
+            body: List of encoded bytes.
+
+        Outputs:
+            packet: String of NBYTES bytes.
+    '''
+    data = [CMD_SEG, seq & 0xff, nseg] + body
+    data += [0]*(NBYTES - CRC_SIZE - len(data))
+
+    return restamp(data, seq)
+
+def restamp(packet, seq):
+    '''
+        Function to give a packet a new sequence number and CRC.
+
+        Inputs:
+            packet: Packet as a string, bytearray or list.
+            seq: Sequence number, taken modulo 256.
+
+        Outputs:
+            packet: String of NBYTES bytes.
+    '''
+    data = bytearray(packet)[:NBYTES - CRC_SIZE]
+    data[1] = seq & 0xff
+    crc = crc16(data)
+    data += bytearray([crc & 0xff, crc >> 8])
+
+    return bytes(data)
+
+def steps(path, feed):
+    '''
+        Function to turn a path in step coordinates into unit segments, the
+        way the Bresenham plotter walks it.
+
+        Inputs:
+            path: List of (x, y) points in steps.
+            feed: Step interval in microseconds.
+
+        Outputs:
+            segments: List of (dx, dy, dz, feed) tuples.
+    '''
+    segments = []
+    for (x1, y1), (x2, y2) in zip(path[:-1], path[1:]):
+        nsteps = max(abs(x2 - x1), abs(y2 - y1))
+        xprev, yprev = x1, y1
+        for idx in range(1, nsteps + 1):
+            x = x1 + int(round((x2 - x1)*idx/float(nsteps)))
+            y = y1 + int(round((y2 - y1)*idx/float(nsteps)))
+            segments.append((x - xprev, y - yprev, 0, feed))
+            xprev, yprev = x, y
+
+    return segments
+
+def _benchmark():
+    '''
+        Function to report segments per packet for reference plots.
+    '''
+    feed = 600
+    npts = 256
+
+    plots = dict()
+    plots['circle'] = [(int(450 + 400*math.cos(2*math.pi*i/npts)),
+                        int(450 + 400*math.sin(2*math.pi*i/npts)))
+                       for i in range(npts + 1)]
+    plots['spiral'] = [(int(450 + 400*i/(4.0*npts)*math.cos(8*math.pi*i/npts)),
+                        int(450 + 400*i/(4.0*npts)*math.sin(8*math.pi*i/npts)))
+                       for i in range(4*npts + 1)]
+    plots['hatch'] = sum([[(50, 50 + 20*i), (850, 50 + 20*i)]
+                          for i in range(40)], [])
+
+    for name in sorted(plots):
+        unit = steps(plots[name], feed)
+        packets, counts = pack(unit)
+        print('%-8s %6d steps %5d packets %6.1f steps/packet '
+              '%5.1f segments/packet (M command: 1 step/packet)' % (
+                name, len(unit), len(packets),
+                len(unit)/float(len(packets)),
+                sum(counts)/float(len(counts))))
+
+if __name__ == '__main__':
+    _benchmark()
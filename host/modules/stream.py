@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+
+'''
+Project: Ewaste 3D Printer
+Module: stream.py
+Functionality: Reads telemetry and trace frames from the CDC serial port of
+               firmware built with -DUSB_RAWHID_SERIAL.
+
+Notes:
+    1. Commands still go over RawHID through motor.py. The serial port only
+       carries frames of sync byte, type, length and data.
+    2. The firmware drops frames while the port is closed or the host falls
+       behind, so frames never hold up motion commands.
+'''
+
+# System imports
+import serial
+
+# Custom imports
+import motor
+
+# Constants from firmware
+STREAM_SYNC     = 0xA5      # First byte of every frame
+RPT_TELEMETRY   = motor.RPT_TELEMETRY
+
+# Global variable port.
+port = None
+
+def open_stream(name='/dev/ttyACM0'):
+    '''
+        Function to open the stream port.
+
+        Inputs:
+            name: Serial device of the printer.
+
+        Outputs:
+            None.
+    '''
+    global port
+
+    # Opening the port raises DTR, which tells the firmware to send frames.
+    port = serial.Serial(name, timeout=1)
+
+def read_frame():
+    '''
+        Function to read the next frame, skipping anything out of sync.
+
+        Inputs:
+            None.
+
+        Outputs:
+            ftype: Frame type, or None on timeout.
+            data: Frame data as a bytearray.
+    '''
+    while True:
+        b = bytearray(port.read(1))
+        if not b:
+            return None, bytearray()
+        if b[0] != STREAM_SYNC:
+            continue
+
+        hdr = bytearray(port.read(2))
+        if len(hdr) < 2:
+            return None, bytearray()
+
+        data = bytearray(port.read(hdr[1]))
+        if len(data) < hdr[1]:
+            return None, bytearray()
+
+        if hdr[0] == RPT_TELEMETRY:
+            motor.decode_telemetry(data)
+
+        return hdr[0], data
@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+
+'''
+Project: Ewaste 3D Printer
+Module: timing.py
+Functionality: Reports how late step edges come and, for firmware built
+               with -DTRACE, where the interrupt cycles go.
+
+Notes:
+    1. Statistics and histograms are kept on the device, so nothing is
+       lost between queries. Only the latest few records of each handler
+       are kept, to show how they interleave.
+    2. Step jitter is measured in every build. An edge a whole step period
+       late means the step interrupt lost at least one tick.
+    3. Running this module prints the step jitter and a table of every
+       traced handler, leaving the device counters running. With -c it
+       restarts them afterwards.
+'''
+
+# System imports
+import sys
+
+# Custom imports
+import motor
+import link
+
+# Handlers traced by the firmware
+SOURCES = [('step', motor.TRACE_STEP), ('enc_isr', motor.TRACE_ENC),
+           ('pos_func', motor.TRACE_POS), ('usb_isr', motor.TRACE_USB)]
+
+# Axes with step edges
+AXES = [('X', motor.JIT_X), ('Y', motor.JIT_Y)]
+
+def report_jitter(clear=False):
+    '''
+        Function to print step jitter and missed deadlines of every axis.
+
+        Inputs:
+            clear: Restart the device counters once they are read.
+
+        Outputs:
+            None.
+    '''
+    for idx, (name, axis) in enumerate(AXES):
+        last = clear and idx == len(AXES) - 1
+        stats = motor.get_jitter(axis, last)
+
+        print('%-9s %8d steps  %8d missed  max late %8.2f us' % (
+            name, stats['steps'], stats['misses'], stats['max_us']))
+        for low, count in stats['hist']:
+            if count:
+                print('%19s >= %9.2f us %6d' % ('', low, count))
+
+def report(clear=False):
+    '''
+        Function to print statistics and histograms of every handler.
+
+        Inputs:
+            clear: Restart the device counters once they are read.
+
+        Outputs:
+            None.
+    '''
+    for idx, (name, source) in enumerate(SOURCES):
+        last = clear and idx == len(SOURCES) - 1
+        stats = motor.get_trace_stats(source, last)
+
+        print('%-9s %8d calls  min %8.2f  avg %8.2f  max %8.2f us' % (
+            name, stats['count'], stats['min_us'], stats['avg_us'],
+            stats['max_us']))
+        for low, count in stats['hist']:
+            if count:
+                print('%19s >= %9.2f us %6d' % ('', low, count))
+
+if __name__ == '__main__':
+    motor.dev = link.open_rawhid()
+    if motor.dev is None:
+        print('printer not connected')
+        sys.exit(1)
+    report_jitter('-c' in sys.argv[1:])
+    if motor.get_capabilities()['features'] & motor.CAP_TRACE:
+        report('-c' in sys.argv[1:])
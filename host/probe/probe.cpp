@@ -0,0 +1,243 @@
+/* Project: Ewaste 3D Printer
+ * Module: probe.cpp
+ * Functionality: Measures command round trips with the 'E' latency probe and
+ *                reports percentiles
+ *
+ * Usage: probe [-n probes] [-w window] [-d /dev/hidrawN]
+ *  -n PROBES 		Probes to send (default 5000)
+ *  -w WINDOW 		Probes in flight, as a batching host would have (default 1)
+ *  -d DEVICE 		hidraw node, found from the USB IDs when not given
+ *
+ * Every reply carries the device micros() when the packet was taken from the
+ * USB stack, when its handler started and when the reply was handed back.
+ * The round trip then splits into
+ *  dispatch 	Waiting in the main loop behind motion and telemetry
+ *  handler 	Running the command and getting a tx packet
+ *  link 		USB scheduling plus the host stack, both ways
+ * and the gap between consecutive receives shows the USB polling interval.
+ *
+ * The printer is opened through Linux hidraw, so nothing beyond the C++
+ * library is needed. Firmware built with -DUSB_VENDOR is not supported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/select.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define NBYTES 			64 		// Size of a report
+#define CMD_ECH 		'E' 	// Latency probe command
+#define TRL_TYPE 		(NBYTES - 3) 	// Report type in the trailer
+#define RPT_REPLY 		0 		// Reply to a command
+
+#define E_RECV 			0 		// Offsets in the probe reply
+#define E_DISPATCH 		4
+#define E_SEND 			8
+#define E_ECHO 			12
+
+#define PROBES_DEFAULT 	5000
+#define TIMEOUT_MS 		2000
+
+// Report descriptor prefix of the RawHID interface, usage page 0xFFAB
+static const uint8_t rawhid_page[] = {0x06, 0xAB, 0xFF};
+
+typedef struct
+{
+	std::chrono::steady_clock::time_point sent;
+	double rtt; 				// Host round trip
+	uint32_t recv, dispatch, send; 	// Device timestamps
+} probe_t;
+
+static uint32_t get32(const uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static std::string find_device(void)
+{
+	std::string base = "/sys/class/hidraw/", path;
+	std::vector<uint8_t> desc(4096);
+	struct dirent *entry;
+	char text[1024];
+	ssize_t n;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(base.c_str());
+	if (dir == NULL)
+		return "";
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, "hidraw", 6))
+			continue;
+		path = base + entry->d_name + "/device/";
+
+		fd = open((path + "uevent").c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+		n = read(fd, text, sizeof(text) - 1);
+		close(fd);
+		text[n > 0 ? n : 0] = 0;
+		if (!strstr(text, "000016C0:00000486") && !strstr(text, "000016C0:0000048C"))
+			continue;
+
+		// Serial emulation shares the IDs, pick the RawHID interface.
+		fd = open((path + "report_descriptor").c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+		n = read(fd, desc.data(), desc.size());
+		close(fd);
+		if (n >= (ssize_t)sizeof(rawhid_page) &&
+				!memcmp(desc.data(), rawhid_page, sizeof(rawhid_page)))
+		{
+			closedir(dir);
+			return std::string("/dev/") + entry->d_name;
+		}
+	}
+
+	closedir(dir);
+	return "";
+}
+
+static int read_reply(int fd, uint8_t *buf)
+{
+	fd_set set;
+	struct timeval tv = {TIMEOUT_MS / 1000, (TIMEOUT_MS % 1000) * 1000};
+
+	// Telemetry reports may arrive in between and are skipped.
+	do
+	{
+		FD_ZERO(&set);
+		FD_SET(fd, &set);
+		if (select(fd + 1, &set, NULL, NULL, &tv) <= 0)
+			return -1;
+		if (read(fd, buf, NBYTES) != NBYTES)
+			return -1;
+	} while (buf[TRL_TYPE] != RPT_REPLY);
+
+	return 0;
+}
+
+static void report(const char *name, std::vector<double> v)
+{
+	static const double pct[] = {50, 90, 99, 99.9};
+	size_t i;
+
+	if (v.empty())
+		return;
+	std::sort(v.begin(), v.end());
+
+	printf("%-10s", name);
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf(" p%-4g %8.1f", pct[i], v[(size_t)(pct[i] / 100 * (v.size() - 1))]);
+	printf("  max %8.1f us\n", v.back());
+}
+
+int main(int argc, char **argv)
+{
+	std::string name;
+	std::vector<probe_t> probes;
+	std::vector<double> rtt, dispatch, handler, link, gap;
+	uint8_t out[NBYTES + 1], in[NBYTES];
+	size_t nprobes = PROBES_DEFAULT, window = 1, sent = 0, done = 0, k;
+	uint32_t idx;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:w:d:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': nprobes = strtoul(optarg, NULL, 0); break;
+			case 'w': window = std::max(1ul, strtoul(optarg, NULL, 0)); break;
+			case 'd': name = optarg; break;
+			default:
+				fprintf(stderr, "usage: probe [-n probes] [-w window] [-d device]\n");
+				return 1;
+		}
+	}
+
+	if (name.empty())
+		name = find_device();
+	if (name.empty())
+	{
+		fprintf(stderr, "probe: printer not found\n");
+		return 1;
+	}
+
+	fd = open(name.c_str(), O_RDWR);
+	if (fd < 0)
+	{
+		perror(name.c_str());
+		return 1;
+	}
+
+	// hidraw takes the report number first, RawHID has none.
+	probes.resize(nprobes);
+	while (done < nprobes)
+	{
+		if (sent < nprobes && sent - done < window)
+		{
+			memset(out, 0, sizeof(out));
+			out[1] = CMD_ECH;
+			idx = sent;
+			memcpy(out + 2, &idx, sizeof(idx));
+			probes[sent].sent = std::chrono::steady_clock::now();
+			if (write(fd, out, sizeof(out)) != sizeof(out))
+			{
+				perror("write");
+				return 1;
+			}
+			sent++;
+			continue;
+		}
+
+		if (read_reply(fd, in) < 0)
+		{
+			fprintf(stderr, "probe: no reply after %zu probes\n", done);
+			return 1;
+		}
+
+		// Index of the probe is echoed back.
+		memcpy(&idx, in + E_ECHO, sizeof(idx));
+		if (idx >= sent)
+			continue;
+		k = idx;
+
+		probes[k].rtt = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - probes[k].sent).count();
+		probes[k].recv = get32(in + E_RECV);
+		probes[k].dispatch = get32(in + E_DISPATCH);
+		probes[k].send = get32(in + E_SEND);
+		done++;
+	}
+	close(fd);
+
+	for (k = 0; k < nprobes; k++)
+	{
+		rtt.push_back(probes[k].rtt);
+		dispatch.push_back((uint32_t)(probes[k].dispatch - probes[k].recv));
+		handler.push_back((uint32_t)(probes[k].send - probes[k].dispatch));
+		link.push_back(probes[k].rtt - (uint32_t)(probes[k].send - probes[k].recv));
+		if (k)
+			gap.push_back((uint32_t)(probes[k].recv - probes[k - 1].recv));
+	}
+
+	printf("%zu probes, window %zu, %s\n", nprobes, window, name.c_str());
+	report("round trip", rtt);
+	report("dispatch", dispatch);
+	report("handler", handler);
+	report("link", link);
+	report("rx gap", gap);
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+/* Project: Ewaste 3D Printer
+ * Module: hostfw.cpp
+ * Functionality: Runs the firmware natively, with RawHID packets on stdin
+ *                and stdout
+ *
+ * Usage: hostfw [-f]
+ *  -f 				Run as fast as the host allows instead of in real time
+ *
+ * Each 64 byte block read from stdin is one packet written to the printer,
+ * and every packet it sends, replies and reports alike, goes to stdout as 64
+ * bytes. The simulated clock is held to the wall clock, so tools talk to it
+ * as to the real device, see link.open_sim(). The machine itself is not
+ * modelled: inputs stay idle and outputs are only recorded. End of input
+ * stops the program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <chrono>
+
+#include <hal.h>
+
+static std::chrono::steady_clock::time_point host_start;
+static uint8_t host_fast = 0;
+static uint8_t host_in[RAWHID_RX_SIZE];
+static size_t host_fill = 0;
+
+static void host_poll(void)
+{
+	uint8_t out[RAWHID_TX_SIZE];
+	struct timeval tv = {0, 0};
+	double ahead;
+	fd_set set;
+	ssize_t n;
+
+	while (sim_usb_read(out))
+	{
+		if (fwrite(out, sizeof(out), 1, stdout) != 1)
+			exit(0);
+	}
+	fflush(stdout);
+
+	// Wait on input while the simulated clock is ahead of the wall clock.
+	if (!host_fast)
+	{
+		ahead = sim_now()/(double)F_CPU - std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - host_start).count();
+		if (ahead > 0)
+		{
+			tv.tv_sec = (time_t)ahead;
+			tv.tv_usec = (suseconds_t)((ahead - tv.tv_sec)*1e6);
+		}
+	}
+
+	FD_ZERO(&set);
+	FD_SET(STDIN_FILENO, &set);
+	if (select(STDIN_FILENO + 1, &set, NULL, NULL, &tv) <= 0)
+		return;
+
+	n = read(STDIN_FILENO, host_in + host_fill, sizeof(host_in) - host_fill);
+	if (n <= 0)
+		exit(0);
+	host_fill += n;
+
+	// A full wire holds the packet back until the firmware takes some.
+	if (host_fill == sizeof(host_in) && sim_usb_write(host_in))
+		host_fill = 0;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f': host_fast = 1; break;
+			default:
+				fprintf(stderr, "usage: hostfw [-f]\n");
+				return 1;
+		}
+	}
+
+	host_start = std::chrono::steady_clock::now();
+	sim_host = host_poll;
+
+	setup();
+	while (1)
+		loop();
+}
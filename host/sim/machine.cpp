@@ -0,0 +1,161 @@
+/* Project: Ewaste 3D Printer
+ * Module: machine.cpp
+ * Functionality: Models the printer mechanics around the simulated
+ *                firmware
+ */
+
+#include <math.h>
+#include <string.h>
+#include <motor.h>
+#include <machine.h>
+
+typedef struct
+{
+	uint8_t stp, dir; 			// Step and direction pins, unused on Z
+	uint8_t sw_zero, sw_end; 	// Switches closing at 0 and at the travel
+	char name;
+} mach_axis_t;
+
+static const mach_axis_t mach_axis[MACH_AXES] =
+{
+	{MOTOR_X_STP, MOTOR_X_DIR, MOTOR_X_SW1, MOTOR_X_SW2, 'X'},
+	{MOTOR_Y_STP, MOTOR_Y_DIR, MOTOR_Y_SW1, MOTOR_Y_SW2, 'Y'},
+	{0, 0, MOTOR_Z_SW2, MOTOR_Z_SW1, 'Z'},
+};
+
+static mach_config_t mach_config;
+static mach_stats_t mach_stats;
+static uint8_t mach_stp[MACH_AXES]; 	// Step pin levels seen
+static int mach_duty_pls = 0, mach_duty_mns = 0;
+static double mach_z_speed = 0; 		// Counts per second
+static uint8_t mach_z_moving = 0;
+
+static void mach_log(uint8_t axis)
+{
+	if (mach_config.log)
+		fprintf(mach_config.log, "%llu %c %d\n",
+				(unsigned long long)(sim_now() / SIM_MHZ),
+				mach_axis[axis].name, (int)floor(mach_stats.pos[axis]));
+}
+
+static void mach_switches(uint8_t axis)
+{
+	const mach_axis_t *a = &mach_axis[axis];
+	double pos = mach_stats.pos[axis];
+
+	sim_pin_set(a->sw_zero, pos > 0);
+	sim_pin_set(a->sw_end, pos < mach_config.travel[axis]);
+}
+
+static void mach_step(uint8_t axis)
+{
+	double *pos = &mach_stats.pos[axis];
+	int dir = sim_pin(mach_axis[axis].dir) ? -1 : 1;
+
+	// The sled stalls against its end stops.
+	if (*pos + dir < -MACH_OVERTRAVEL ||
+			*pos + dir > mach_config.travel[axis] + MACH_OVERTRAVEL)
+	{
+		mach_stats.stalls[axis]++;
+		return;
+	}
+
+	*pos += dir;
+	mach_stats.steps[axis]++;
+	mach_stats.last = sim_now();
+	mach_log(axis);
+	mach_switches(axis);
+}
+
+static void mach_z_physics(void)
+{
+	double dt = MACH_Z_DT*1e-6, decay = exp(-dt/MACH_Z_TAU);
+	double target = MACH_Z_SPEED*(mach_duty_mns - mach_duty_pls)/255.0;
+	double *pos = &mach_stats.pos[Z_AXIS], last = *pos;
+	double low = -MACH_OVERTRAVEL, high = mach_config.travel[Z_AXIS] + MACH_OVERTRAVEL;
+	long count;
+
+	// Exact for a drive held over the step.
+	*pos += target*dt + (mach_z_speed - target)*MACH_Z_TAU*(1 - decay);
+	mach_z_speed = target + (mach_z_speed - target)*decay;
+
+	if (*pos < low || *pos > high)
+	{
+		*pos = (*pos < low) ? low : high;
+		mach_z_speed = 0;
+	}
+
+	// Every count passed is an encoder edge.
+	for (count = (long)floor(last); count != (long)floor(*pos);)
+	{
+		count += (*pos > last) ? 1 : -1;
+		sim_pin_set(MOTOR_Z_ENC, count & 1);
+		mach_stats.steps[Z_AXIS]++;
+		mach_stats.last = sim_now();
+		if (mach_config.log)
+			fprintf(mach_config.log, "%llu Z %ld\n",
+					(unsigned long long)(sim_now() / SIM_MHZ), count);
+	}
+	mach_switches(Z_AXIS);
+
+	if (target == 0 && fabs(mach_z_speed) < MACH_Z_REST)
+	{
+		mach_z_speed = 0;
+		mach_z_moving = 0;
+		return;
+	}
+
+	sim_at(sim_now() + (uint64_t)MACH_Z_DT*SIM_MHZ, mach_z_physics);
+}
+
+static void mach_write(uint8_t pin, int val)
+{
+	uint8_t axis;
+
+	for (axis = X_AXIS; axis <= Y_AXIS; axis++)
+	{
+		if (pin != mach_axis[axis].stp)
+			continue;
+		if (val && !mach_stp[axis])
+			mach_step(axis);
+		mach_stp[axis] = (val != 0);
+		return;
+	}
+
+	if (pin == MOTOR_Z_PLS)
+		mach_duty_pls = val;
+	else if (pin == MOTOR_Z_MNS)
+		mach_duty_mns = val;
+	else
+		return;
+
+	// Z rests without physics until driven again.
+	if (!mach_z_moving && mach_duty_pls != mach_duty_mns)
+	{
+		mach_z_moving = 1;
+		sim_at(sim_now() + (uint64_t)MACH_Z_DT*SIM_MHZ, mach_z_physics);
+	}
+}
+
+void mach_init(const mach_config_t *config)
+{
+	uint8_t axis;
+
+	mach_config = *config;
+	memset(&mach_stats, 0, sizeof(mach_stats));
+	memset(mach_stp, 0, sizeof(mach_stp));
+
+	for (axis = 0; axis < MACH_AXES; axis++)
+	{
+		mach_stats.pos[axis] = config->start[axis];
+		mach_switches(axis);
+	}
+	sim_pin_set(MOTOR_Z_ENC, (long)floor(config->start[Z_AXIS]) & 1);
+
+	sim_write_hook = mach_write;
+}
+
+void mach_read(mach_stats_t *stats)
+{
+	*stats = mach_stats;
+}
@@ -0,0 +1,57 @@
+/* Project: Ewaste 3D Printer
+ * Module: machine.h
+ * Functionality: Models the printer mechanics around the simulated
+ *                firmware
+ *
+ * X and Y are steppers on sleds. Each rising edge on a step pin moves the
+ * sled one step, towards SW1 with the direction pin low (DIR1), as the
+ * firmware counts. The sled runs from 0 to its travel, where the switches
+ * close, and stalls MACH_OVERTRAVEL steps further on, losing the steps.
+ *
+ * Z is a DC motor with first order inertia. MOTOR_Z_MNS drives it up the
+ * encoder count and MOTOR_Z_PLS down, at a speed proportional to the duty.
+ * It keeps coasting when the drive stops, and every count it passes toggles
+ * the encoder pin feeding enc_isr(), whichever way it moves. Its physics
+ * run every MACH_Z_DT while it moves and not at all while it rests.
+ *
+ * Switches read low when closed. X and Y close MOTOR_*_SW1 at 0 and
+ * MOTOR_*_SW2 at the far end, so DIR1 runs towards MOTOR_SW1_ON. Z closes
+ * MOTOR_Z_SW2 at 0 and MOTOR_Z_SW1 at the far end, which is how
+ * motor_z_calib() finds its travel.
+ *
+ * Steps and encoder counts can be written to a log as they happen, one
+ * line each of the time in microseconds, the axis and the position.
+ */
+
+#ifndef MACHINE_H_
+#define MACHINE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define MACH_AXES 			3
+#define MACH_OVERTRAVEL 	4 		// Steps between a switch and the end stop
+#define MACH_Z_DT 			50 		// Microseconds per Z physics step
+#define MACH_Z_SPEED 		400.0 	// Counts per second at full duty
+#define MACH_Z_TAU 			0.015 	// Seconds for the speed to settle
+#define MACH_Z_REST 		1.0 	// Counts per second taken as stopped
+
+typedef struct
+{
+	int travel[MACH_AXES]; 			// Steps or counts between the switches
+	double start[MACH_AXES]; 		// Position at power on
+	FILE *log; 						// Step log, or NULL
+} mach_config_t;
+
+typedef struct
+{
+	uint32_t steps[MACH_AXES]; 		// Steps taken, encoder counts for Z
+	uint32_t stalls[MACH_AXES]; 	// Steps lost against an end stop
+	double pos[MACH_AXES]; 			// Position now
+	uint64_t last; 					// Clock at the last step or count
+} mach_stats_t;
+
+void mach_init(const mach_config_t *config); 	// Attach to the backend
+void mach_read(mach_stats_t *stats); 			// Counters and positions
+
+#endif
@@ -0,0 +1,83 @@
+/* Project: Ewaste 3D Printer
+ * Module: schedcheck.cpp
+ * Functionality: Checks the scheduler in src/schedule.cpp on the host build,
+ *                in virtual time
+ *
+ * Usage: schedcheck
+ *
+ * A periodic timer runs for a while, then interrupts are masked with
+ * hal_irq_save() across several SysTick wraps. The simulated PIT, like the
+ * real one, keeps only one tick pending, so the tick interrupt that runs at
+ * hal_irq_restore() has to catch up the rest from hal_clock(). Every check
+ * prints a line, and the exit status is 1 if any failed.
+ */
+
+#include <stdio.h>
+
+#include <hal.h>
+#include <schedule.h>
+
+#define CHECK_MASKED 	5 		// SysTick wraps with interrupts masked
+
+static sched_timer_t check_periodic, check_once;
+static uint32_t check_periodic_runs = 0, check_once_runs = 0;
+static uint32_t check_periodic_tick = 0; 	// sched_ticks() at the last run
+static int check_failed = 0;
+
+static void check_periodic_fn(void)
+{
+	check_periodic_runs++;
+	check_periodic_tick = sched_ticks();
+}
+
+static void check_once_fn(void)
+{
+	check_once_runs++;
+}
+
+static void check(const char *what, uint32_t got, uint32_t want)
+{
+	printf("%-40s %6u %s\n", what, (unsigned)got, got == want ? "ok" : "FAILED");
+	if (got != want)
+	{
+		printf("%-40s %6u\n", "  expected", (unsigned)want);
+		check_failed = 1;
+	}
+}
+
+int main(void)
+{
+	uint32_t primask, ticks;
+
+	sched_start(&check_periodic, check_periodic_fn, 1, 1);
+	sched_start(&check_once, check_once_fn, 3, 0);
+	sim_advance(10*SIM_TICK);
+	check("ticks after 10 ms", sched_ticks(), 10);
+	check("periodic runs", check_periodic_runs, 10);
+	check("one-shot runs", check_once_runs, 1);
+
+	// Mask halfway through a tick, so the masked time crosses CHECK_MASKED
+	// SysTick wraps and the restore lands between two ticks.
+	sim_advance(SIM_TICK/2);
+	primask = hal_irq_save();
+	ticks = sched_ticks();
+	sim_advance(CHECK_MASKED*SIM_TICK);
+	check("ticks while masked", sched_ticks() - ticks, 0);
+	hal_irq_restore(primask);
+	check("ticks caught up at restore", sched_ticks() - ticks, CHECK_MASKED);
+	check("periodic runs after restore", check_periodic_runs, 10 + CHECK_MASKED);
+	check("periodic saw the last tick", check_periodic_tick, sched_ticks());
+
+	// The catch-up must not have moved the next deadline.
+	sim_advance(SIM_TICK/2 - 1);
+	check("no tick before the next boundary", sched_ticks() - ticks, CHECK_MASKED);
+	sim_advance(1);
+	check("tick on the next boundary", sched_ticks() - ticks, CHECK_MASKED + 1);
+
+	sched_stop(&check_periodic);
+	ticks = sched_ticks();
+	sim_advance(10*SIM_TICK);
+	check("ticks with no timer armed", sched_ticks() - ticks, 0);
+
+	return check_failed;
+}
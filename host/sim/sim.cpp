@@ -0,0 +1,422 @@
+/* Project: Ewaste 3D Printer
+ * Module: sim.cpp
+ * Functionality: Virtual clock, pins, timers and interrupt dispatch of the
+ *                simulated backend
+ */
+
+#include <sim.h>
+#include <sim_int.h>
+
+typedef struct
+{
+	void (*isr)(void); 			// Handler, NULL while the channel is free
+	uint64_t period; 			// Cycles loaded at the next reload
+	uint64_t deadline; 			// Clock of the next interrupt
+	uint8_t once; 				// Stop after the next interrupt
+	uint8_t running; 			// Counting, clear once a one-shot fired
+} sim_timer_t;
+
+typedef struct
+{
+	void (*fn)(void); 			// Model code, NULL while the slot is free
+	uint64_t when; 				// Clock to run it at
+} sim_event_t;
+
+void (*sim_host)(void) = 0;
+void (*sim_write_hook)(uint8_t pin, int val) = 0;
+
+static uint64_t sim_clock = 0;
+static uint8_t sim_irq_on = 1; 		// Interrupts enabled
+static uint8_t sim_in_isr = 0; 		// An interrupt is running
+
+static uint8_t sim_mode[SIM_PINS];
+static int sim_out[SIM_PINS]; 		// Level or duty written
+static uint8_t sim_low[SIM_PINS]; 	// Inputs driven low
+static void (*sim_pin_isr[SIM_PINS])(void);
+static uint8_t sim_pin_edge[SIM_PINS]; 	// Mode given to attachInterrupt()
+static uint8_t sim_pin_pending[SIM_PINS];
+
+static sim_timer_t sim_timers[SIM_TIMERS];
+static sim_event_t sim_events[SIM_EVENTS];
+
+uint64_t sim_now(void)
+{
+	return sim_clock;
+}
+
+static void sim_isr(void (*isr)(void))
+{
+	sim_in_isr = 1;
+	isr();
+	sim_in_isr = 0;
+}
+
+static sim_timer_t *sim_timer_due(uint64_t limit)
+{
+	sim_timer_t *t, *due = 0;
+
+	for (t = sim_timers; t < sim_timers + SIM_TIMERS; t++)
+		if (t->isr && t->running && t->deadline <= limit && (!due || t->deadline < due->deadline))
+			due = t;
+
+	return due;
+}
+
+static void sim_timer_run(sim_timer_t *t)
+{
+	// The PIT reloads on its own, a late handler does not shift the period.
+	// The handler may update the period, which then starts a cycle later.
+	if (t->once)
+		t->running = 0;
+	t->deadline += t->period;
+	if (t->deadline <= sim_clock)
+		t->deadline += ((sim_clock - t->deadline)/t->period + 1)*t->period;
+
+	sim_isr(t->isr);
+}
+
+uint8_t sim_at(uint64_t when, void (*fn)(void))
+{
+	sim_event_t *e;
+
+	for (e = sim_events; e < sim_events + SIM_EVENTS; e++)
+	{
+		if (!e->fn)
+		{
+			e->fn = fn;
+			e->when = when;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static sim_event_t *sim_event_due(uint64_t limit)
+{
+	sim_event_t *e, *due = 0;
+
+	for (e = sim_events; e < sim_events + SIM_EVENTS; e++)
+		if (e->fn && e->when <= limit && (!due || e->when < due->when))
+			due = e;
+
+	return due;
+}
+
+static void sim_event_run(sim_event_t *e)
+{
+	void (*fn)(void) = e->fn;
+
+	// Free the slot first, so the model can schedule itself again.
+	if (e->when > sim_clock)
+		sim_clock = e->when;
+	e->fn = 0;
+	fn();
+}
+
+void sim_dispatch(void)
+{
+	sim_timer_t *t;
+	uint8_t pin, ran;
+
+	do
+	{
+		if (!sim_irq_on || sim_in_isr)
+			return;
+		ran = 1;
+
+		t = sim_timer_due(sim_clock);
+		if (t)
+		{
+			sim_timer_run(t);
+			continue;
+		}
+
+		for (pin = 0; pin < SIM_PINS; pin++)
+			if (sim_pin_pending[pin])
+				break;
+		if (pin < SIM_PINS)
+		{
+			sim_pin_pending[pin] = 0;
+			sim_isr(sim_pin_isr[pin]);
+			continue;
+		}
+
+		sim_in_isr = 1;
+		ran = sim_usb_isr();
+		sim_in_isr = 0;
+	} while (ran);
+}
+
+void sim_advance(uint64_t cycles)
+{
+	uint64_t target = sim_clock + cycles;
+	sim_timer_t *t;
+	sim_event_t *e;
+
+	// Models and interrupts run one at a time along the way, models first
+	// when both fall on the same cycle.
+	while (1)
+	{
+		t = (sim_irq_on && !sim_in_isr) ? sim_timer_due(target) : 0;
+		e = sim_event_due(t ? t->deadline : target);
+		if (e)
+		{
+			sim_event_run(e);
+			sim_dispatch();
+			continue;
+		}
+		if (!t)
+			break;
+
+		if (t->deadline > sim_clock)
+			sim_clock = t->deadline;
+		sim_dispatch();
+	}
+
+	if (target > sim_clock)
+		sim_clock = target;
+	sim_dispatch();
+}
+
+// Pins
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin < SIM_PINS)
+		sim_mode[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if (pin >= SIM_PINS)
+		return;
+
+	sim_out[pin] = val ? HIGH : LOW;
+	if (sim_write_hook)
+		sim_write_hook(pin, sim_out[pin]);
+}
+
+uint8_t digitalRead(uint8_t pin)
+{
+	if (pin >= SIM_PINS)
+		return LOW;
+	if (sim_mode[pin] == OUTPUT)
+		return sim_out[pin] ? HIGH : LOW;
+
+	return sim_low[pin] ? LOW : HIGH;
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+	if (pin >= SIM_PINS)
+		return;
+
+	sim_out[pin] = val;
+	if (sim_write_hook)
+		sim_write_hook(pin, val);
+}
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode)
+{
+	if (pin >= SIM_PINS)
+		return;
+
+	sim_pin_isr[pin] = function;
+	sim_pin_edge[pin] = mode;
+}
+
+void sim_pin_set(uint8_t pin, uint8_t val)
+{
+	uint8_t low = !val, edge;
+
+	if (pin >= SIM_PINS || sim_low[pin] == low)
+		return;
+	sim_low[pin] = low;
+
+	edge = sim_pin_edge[pin];
+	if (sim_pin_isr[pin] && (edge == CHANGE || (edge == RISING && val) ||
+			(edge == FALLING && !val)))
+		sim_pin_pending[pin] = 1;
+	sim_dispatch();
+}
+
+int sim_pin(uint8_t pin)
+{
+	return (pin < SIM_PINS) ? sim_out[pin] : 0;
+}
+
+// Time
+
+uint32_t micros(void)
+{
+	return (uint32_t)(sim_clock / SIM_MHZ);
+}
+
+uint32_t millis(void)
+{
+	return (uint32_t)(sim_clock / SIM_TICK);
+}
+
+void delay(uint32_t ms)
+{
+	sim_advance((uint64_t)ms*SIM_TICK);
+}
+
+void delayMicroseconds(uint32_t usec)
+{
+	sim_advance((uint64_t)usec*SIM_MHZ);
+}
+
+// Interrupts
+
+void sim_irq_disable(void)
+{
+	sim_irq_on = 0;
+}
+
+void sim_irq_enable(void)
+{
+	sim_irq_on = 1;
+	sim_dispatch();
+}
+
+uint32_t hal_tick(void)
+{
+	return SIM_TICK - 1 - (uint32_t)(sim_clock % SIM_TICK);
+}
+
+uint32_t hal_tick_cycles(uint32_t begin)
+{
+	uint32_t cycles = begin - hal_tick();
+
+	if (cycles > SIM_TICK - 1)
+		cycles += SIM_TICK;
+
+	return cycles;
+}
+
+uint32_t hal_cycles(void)
+{
+	return (uint32_t)sim_clock;
+}
+
+uint64_t hal_clock(void)
+{
+	return sim_clock;
+}
+
+uint32_t hal_irq_save(void)
+{
+	uint32_t primask = !sim_irq_on;
+
+	sim_irq_on = 0;
+	return primask;
+}
+
+void hal_irq_restore(uint32_t primask)
+{
+	if (!primask)
+		sim_irq_enable();
+}
+
+void hal_wfi(void)
+{
+	sim_timer_t *t;
+	sim_event_t *e;
+	uint64_t next;
+	uint8_t pin;
+
+	if (sim_host)
+		sim_host();
+
+	while (1)
+	{
+		// A pending interrupt wakes the core at once.
+		for (pin = 0; pin < SIM_PINS; pin++)
+			if (sim_pin_pending[pin])
+				return;
+		if (sim_usb_due())
+			return;
+
+		// Otherwise SysTick, unless a timer comes first. Models run on
+		// meanwhile and may raise a pin interrupt.
+		next = (sim_clock / SIM_TICK + 1)*SIM_TICK;
+		t = sim_timer_due(next);
+		if (t)
+			next = t->deadline;
+
+		e = sim_event_due(next);
+		if (e == 0)
+			break;
+		sim_event_run(e);
+	}
+
+	if (next > sim_clock)
+		sim_clock = next;
+}
+
+// IntervalTimer
+
+bool IntervalTimer::start(void (*funct)(), uint32_t microseconds, uint8_t once)
+{
+	sim_timer_t *t;
+	uint32_t primask;
+
+	if (microseconds == 0)
+		return false;
+
+	// A running timer restarts on its own channel.
+	if (channel < 0)
+	{
+		for (channel = 0; channel < SIM_TIMERS; channel++)
+			if (!sim_timers[channel].isr)
+				break;
+		if (channel == SIM_TIMERS)
+		{
+			channel = -1;
+			return false;
+		}
+	}
+
+	primask = hal_irq_save();
+	t = &sim_timers[channel];
+	t->isr = funct;
+	t->period = (uint64_t)microseconds*SIM_MHZ;
+	t->deadline = sim_clock + t->period;
+	t->once = once;
+	t->running = 1;
+	hal_irq_restore(primask);
+
+	return true;
+}
+
+bool IntervalTimer::begin(void (*funct)(), uint32_t microseconds)
+{
+	return start(funct, microseconds, 0);
+}
+
+bool IntervalTimer::beginOneShot(void (*funct)(), uint32_t microseconds)
+{
+	return start(funct, microseconds, 1);
+}
+
+bool IntervalTimer::update(uint32_t microseconds)
+{
+	if (channel < 0 || microseconds == 0)
+		return false;
+
+	// Taken at the next reload, the current cycle runs out first.
+	sim_timers[channel].period = (uint64_t)microseconds*SIM_MHZ;
+	return true;
+}
+
+void IntervalTimer::end(void)
+{
+	if (channel < 0)
+		return;
+
+	sim_timers[channel].isr = 0;
+	sim_timers[channel].running = 0;
+	channel = -1;
+}
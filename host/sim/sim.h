@@ -0,0 +1,144 @@
+/* Project: Ewaste 3D Printer
+ * Module: sim.h
+ * Functionality: Simulated backend for the firmware built on the host with
+ *                -DHOST_BUILD, included through src/hal.h
+ *
+ * Provides the Teensy calls the firmware makes, against a virtual clock
+ * counting cycles at F_CPU:
+ *  Pins 		Levels are kept per pin. Inputs idle high, like the switches
+ * 				with their pull-ups, and are driven with sim_pin_set().
+ * 				Every write is passed on to sim_write_hook.
+ *  Time 		The clock only moves in delay(), delayMicroseconds(), busy
+ * 				waits and hal_wfi(), which skips to the next interrupt.
+ *  Models 		Code outside the firmware, like the machine in machine.h,
+ * 				runs at set clock values through sim_at(). It runs even
+ * 				with interrupts disabled, as the hardware would move on.
+ *  Interrupts 	IntervalTimer (two channels, as the PIT on the LC, with
+ * 				update() and one-shots), pin changes and received
+ * 				packets. They run at the next __enable_irq() or clock
+ * 				step once due, one at a time, and late ones keep the
+ * 				hardware's period.
+ *  USB 		The RawHID endpoints of the core, with the buffer pool sized
+ * 				and counted as in usb_mem.c. The host side writes and reads
+ * 				packets with sim_usb_write() and sim_usb_read().
+ *
+ * Whenever the firmware waits, for an interrupt, a packet or a tx buffer,
+ * sim_host() is called first so the driver can act as the USB host. It must
+ * keep the firmware fed, or exit, or the firmware waits forever.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <usb_desc.h>
+#include <usb_mem.h>
+
+#if !defined(USB_RAWHID) || defined(USB_VENDOR) || defined(USB_RAWHID_SERIAL)
+#error "host builds only simulate the RawHID transport"
+#endif
+
+#define HIGH 			1
+#define LOW 			0
+#define INPUT 			0
+#define OUTPUT 			1
+#define INPUT_PULLUP 	2
+#define FALLING 		2
+#define RISING 			3
+#define CHANGE 			4
+
+#define SIM_PINS 		34 		// Digital pins of the Teensy LC
+#define SIM_TIMERS 		2 		// PIT channels of the LC
+#define SIM_WIRE 		64 		// Packets the host may have written ahead
+#define SIM_TX_LIMIT 	4 		// Tx packets queued per endpoint, as usb_rawhid.c
+#define SIM_EVENTS 		4 		// Model events pending at once
+
+#define SIM_MHZ 		(F_CPU / 1000000) 	// Cycles per microsecond
+#define SIM_TICK 		(F_CPU / 1000) 		// Cycles per SysTick wrap
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pins
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+uint8_t digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode);
+#define digitalPinToInterrupt(p) 	(p)
+#define digitalWriteFast(p, v) 		digitalWrite(p, v)
+#define digitalReadFast(p) 			digitalRead(p)
+
+// Code placement, there are no flash wait states to avoid on the host
+#define FASTRUN
+
+// Time
+uint32_t micros(void);
+uint32_t millis(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t usec);
+
+// Interrupts
+void sim_irq_disable(void);
+void sim_irq_enable(void);
+#define __disable_irq() 	sim_irq_disable()
+#define __enable_irq() 		sim_irq_enable()
+
+uint32_t hal_tick(void);
+uint32_t hal_tick_cycles(uint32_t begin);
+uint32_t hal_cycles(void);
+uint64_t hal_clock(void);
+uint32_t hal_irq_save(void);
+void hal_irq_restore(uint32_t primask);
+void hal_wfi(void);
+
+// USB, as in usb_dev.h and usb_rawhid.h
+extern volatile uint8_t usb_configuration;
+
+typedef int (*usb_rx_callback_t)(uint32_t endpoint, usb_packet_t *packet);
+
+void usb_init(void);
+void usb_tx(uint32_t endpoint, usb_packet_t *packet);
+void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet);
+void usb_rx_set_callback(uint32_t endpoint, usb_rx_callback_t callback);
+uint32_t usb_tx_packet_count(uint32_t endpoint);
+int usb_rawhid_available(void);
+usb_packet_t *usb_rawhid_rx_packet(void);
+usb_packet_t *usb_rawhid_tx_packet(uint32_t timeout);
+void usb_rawhid_tx_commit(usb_packet_t *tx_packet);
+
+// Driver side
+void setup(void); 							// Firmware start, from src/main.cpp
+void loop(void); 							// One pass of the firmware main loop
+extern void (*sim_host)(void); 				// Called before the firmware waits
+extern void (*sim_write_hook)(uint8_t pin, int val); 	// Called after pin writes
+uint8_t sim_at(uint64_t when, void (*fn)(void)); 	// Run model code, 0 if full
+uint64_t sim_now(void); 					// Cycles since start
+void sim_advance(uint64_t cycles); 			// Move the clock, running interrupts
+void sim_pin_set(uint8_t pin, uint8_t val); // Drive an input pin
+int sim_pin(uint8_t pin); 					// Last level or duty written
+uint8_t sim_usb_write(const uint8_t *buf); 	// Host to device, 0 if the wire is full
+uint8_t sim_usb_read(uint8_t *buf); 		// Device to host, 0 if nothing sent
+uint32_t sim_usb_backlog(void); 			// Packets written and not yet received
+void sim_dispatch(void); 					// Run due interrupts if enabled
+
+#ifdef __cplusplus
+}
+
+class IntervalTimer
+{
+public:
+	IntervalTimer() : channel(-1) {}
+	~IntervalTimer() { end(); }
+	bool begin(void (*funct)(), uint32_t microseconds);
+	bool beginOneShot(void (*funct)(), uint32_t microseconds);
+	bool update(uint32_t microseconds);
+	void end(void);
+private:
+	bool start(void (*funct)(), uint32_t microseconds, uint8_t once);
+	int channel;
+};
+#endif
+
+#endif
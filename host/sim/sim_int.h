@@ -0,0 +1,14 @@
+/* Project: Ewaste 3D Printer
+ * Module: sim_int.h
+ * Functionality: Calls between the files of the simulated backend
+ */
+
+#ifndef SIM_INT_H_
+#define SIM_INT_H_
+
+#include <stdint.h>
+
+uint8_t sim_usb_due(void); 		// A written packet can be received now
+uint8_t sim_usb_isr(void); 		// Receive one written packet, 0 if none
+
+#endif
@@ -0,0 +1,343 @@
+/* Project: Ewaste 3D Printer
+ * Module: sim_usb.cpp
+ * Functionality: USB buffer pool and RawHID endpoints of the simulated
+ *                backend
+ *
+ * Packets the host writes wait on the wire until the receive interrupt
+ * finds a free buffer for them, as the hardware NAKs while it has none.
+ * Sent packets stay queued on their endpoint until the host reads them.
+ */
+
+#include <string.h>
+#include <sim.h>
+#include <sim_int.h>
+
+volatile uint8_t usb_configuration = 0;
+
+// Buffer pool, counted as in usb_mem.c
+static usb_packet_t usb_pool[NUM_USB_BUFFERS];
+static uint8_t usb_pool_used[NUM_USB_BUFFERS];
+static uint8_t usb_pool_owner[NUM_USB_BUFFERS];
+static usb_mem_stats_t usb_mem_pool = {0, 0, 0, 0, NUM_USB_BUFFERS};
+static usb_mem_stats_t usb_mem_ep[NUM_ENDPOINTS + 1];
+
+// Endpoint queues, indexed from endpoint 1
+static usb_packet_t *usb_rx_first[NUM_ENDPOINTS], *usb_rx_last[NUM_ENDPOINTS];
+static usb_packet_t *usb_tx_first[NUM_ENDPOINTS], *usb_tx_last[NUM_ENDPOINTS];
+static uint32_t usb_tx_count[NUM_ENDPOINTS];
+static usb_rx_callback_t usb_rx_callback[NUM_ENDPOINTS];
+
+// Packets written by the host and not yet received
+static uint8_t sim_wire[SIM_WIRE][RAWHID_RX_SIZE];
+static uint32_t sim_wire_head = 0, sim_wire_tail = 0;
+
+static usb_packet_t *usb_malloc_owner(uint8_t ep)
+{
+	uint32_t primask = hal_irq_save();
+	uint8_t n;
+
+	for (n = 0; n < NUM_USB_BUFFERS; n++)
+		if (!usb_pool_used[n])
+			break;
+
+	if (n == NUM_USB_BUFFERS || usb_mem_ep[ep].in_use >= usb_mem_ep[ep].quota ||
+			(ep && usb_mem_pool.in_use >= NUM_USB_BUFFERS - USB_MEM_RX_RESERVE))
+	{
+		usb_mem_pool.fails++;
+		usb_mem_ep[ep].fails++;
+		hal_irq_restore(primask);
+		return NULL;
+	}
+
+	usb_pool_used[n] = 1;
+	usb_pool_owner[n] = ep;
+	usb_mem_pool.allocs++;
+	if (++usb_mem_pool.in_use > usb_mem_pool.high_water)
+		usb_mem_pool.high_water = usb_mem_pool.in_use;
+	usb_mem_ep[ep].allocs++;
+	if (++usb_mem_ep[ep].in_use > usb_mem_ep[ep].high_water)
+		usb_mem_ep[ep].high_water = usb_mem_ep[ep].in_use;
+	hal_irq_restore(primask);
+
+	usb_pool[n].len = 0;
+	usb_pool[n].index = 0;
+	usb_pool[n].next = NULL;
+	return &usb_pool[n];
+}
+
+usb_packet_t *usb_malloc(void)
+{
+	return usb_malloc_owner(0);
+}
+
+usb_packet_t *usb_malloc_ep(uint8_t endpoint)
+{
+	if (endpoint > NUM_ENDPOINTS)
+		endpoint = 0;
+	return usb_malloc_owner(endpoint);
+}
+
+void usb_free(usb_packet_t *p)
+{
+	uint32_t n = p - usb_pool, primask;
+
+	if (n >= NUM_USB_BUFFERS || !usb_pool_used[n])
+		return;
+
+	primask = hal_irq_save();
+	usb_mem_ep[usb_pool_owner[n]].in_use--;
+	usb_mem_pool.in_use--;
+	usb_pool_used[n] = 0;
+	hal_irq_restore(primask);
+}
+
+void usb_mem_give(usb_packet_t *p, uint8_t endpoint)
+{
+	uint32_t n = p - usb_pool, primask;
+
+	if (n >= NUM_USB_BUFFERS || !usb_pool_used[n] || endpoint > NUM_ENDPOINTS)
+		return;
+
+	primask = hal_irq_save();
+	usb_mem_ep[usb_pool_owner[n]].in_use--;
+	usb_pool_owner[n] = endpoint;
+	if (++usb_mem_ep[endpoint].in_use > usb_mem_ep[endpoint].high_water)
+		usb_mem_ep[endpoint].high_water = usb_mem_ep[endpoint].in_use;
+	hal_irq_restore(primask);
+}
+
+const usb_mem_stats_t *usb_mem_stats(uint8_t endpoint)
+{
+	if (endpoint == USB_MEM_POOL)
+		return &usb_mem_pool;
+	if (endpoint > NUM_ENDPOINTS)
+		return NULL;
+	return &usb_mem_ep[endpoint];
+}
+
+void usb_mem_set_quota(uint8_t endpoint, uint8_t quota)
+{
+	if (endpoint == 0 || endpoint > NUM_ENDPOINTS)
+		return;
+	usb_mem_ep[endpoint].quota = quota;
+}
+
+void usb_mem_clear_stats(void)
+{
+	uint32_t primask = hal_irq_save();
+	uint8_t i;
+
+	usb_mem_pool.allocs = usb_mem_pool.fails = 0;
+	usb_mem_pool.high_water = usb_mem_pool.in_use;
+	for (i = 0; i <= NUM_ENDPOINTS; i++)
+	{
+		usb_mem_ep[i].allocs = usb_mem_ep[i].fails = 0;
+		usb_mem_ep[i].high_water = usb_mem_ep[i].in_use;
+	}
+	hal_irq_restore(primask);
+}
+
+void usb_init(void)
+{
+	uint8_t i;
+
+	usb_mem_ep[0].quota = NUM_USB_BUFFERS;
+	for (i = 1; i <= NUM_ENDPOINTS; i++)
+		usb_mem_ep[i].quota = USB_MEM_TX_QUOTA;
+
+	// Enumeration is instant.
+	usb_configuration = 1;
+}
+
+static void usb_queue(usb_packet_t **first, usb_packet_t **last, usb_packet_t *packet)
+{
+	packet->next = NULL;
+	if (*first == NULL)
+		*first = packet;
+	else
+		(*last)->next = packet;
+	*last = packet;
+}
+
+void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS)
+		return;
+
+	usb_queue(&usb_tx_first[endpoint], &usb_tx_last[endpoint], packet);
+	usb_tx_count[endpoint]++;
+}
+
+void usb_tx(uint32_t endpoint, usb_packet_t *packet)
+{
+	uint32_t primask = hal_irq_save();
+
+	usb_tx_isr(endpoint, packet);
+	hal_irq_restore(primask);
+}
+
+void usb_rx_set_callback(uint32_t endpoint, usb_rx_callback_t callback)
+{
+	endpoint--;
+	if (endpoint < NUM_ENDPOINTS)
+		usb_rx_callback[endpoint] = callback;
+}
+
+uint32_t usb_tx_packet_count(uint32_t endpoint)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS)
+		return 0;
+	return usb_tx_count[endpoint];
+}
+
+int usb_rawhid_available(void)
+{
+	usb_packet_t *p;
+	int count = 0;
+
+	if (!usb_configuration)
+		return 0;
+
+	for (p = usb_rx_first[RAWHID_RX_ENDPOINT - 1]; p; p = p->next)
+		count += p->len;
+
+	// Busy waits on this give the host one frame per call.
+	if (count == 0)
+	{
+		if (sim_host)
+			sim_host();
+		sim_advance(SIM_TICK);
+	}
+
+	return count;
+}
+
+usb_packet_t *usb_rawhid_rx_packet(void)
+{
+	uint32_t ep = RAWHID_RX_ENDPOINT - 1;
+	usb_packet_t *p;
+
+	if (!usb_configuration)
+		return NULL;
+
+	// usb_rx() enables interrupts after the dequeue whatever the caller
+	// had, so one pending runs before this returns.
+	sim_irq_disable();
+	p = usb_rx_first[ep];
+	if (p)
+		usb_rx_first[ep] = p->next;
+	sim_irq_enable();
+
+	return p;
+}
+
+usb_packet_t *usb_rawhid_tx_packet(uint32_t timeout)
+{
+	usb_packet_t *tx_packet;
+	uint32_t begin = millis();
+
+	while (1)
+	{
+		if (!usb_configuration)
+			return NULL;
+		if (usb_tx_packet_count(RAWHID_TX_ENDPOINT) < SIM_TX_LIMIT)
+		{
+			tx_packet = usb_malloc_ep(RAWHID_TX_ENDPOINT);
+			if (tx_packet)
+				return tx_packet;
+		}
+		if (!timeout || millis() - begin > timeout)
+			return NULL;
+
+		// The host reads once a frame.
+		if (sim_host)
+			sim_host();
+		sim_advance(SIM_TICK);
+	}
+}
+
+void usb_rawhid_tx_commit(usb_packet_t *tx_packet)
+{
+	tx_packet->len = RAWHID_TX_SIZE;
+	usb_tx(RAWHID_TX_ENDPOINT, tx_packet);
+}
+
+uint8_t sim_usb_write(const uint8_t *buf)
+{
+	if (sim_wire_head - sim_wire_tail == SIM_WIRE)
+		return 0;
+
+	memcpy(sim_wire[sim_wire_head % SIM_WIRE], buf, RAWHID_RX_SIZE);
+	sim_wire_head++;
+	sim_dispatch();
+	return 1;
+}
+
+uint32_t sim_usb_backlog(void)
+{
+	return sim_wire_head - sim_wire_tail;
+}
+
+uint8_t sim_usb_read(uint8_t *buf)
+{
+	uint32_t ep = RAWHID_TX_ENDPOINT - 1, primask;
+	usb_packet_t *p;
+
+	primask = hal_irq_save();
+	p = usb_tx_first[ep];
+	if (p)
+	{
+		usb_tx_first[ep] = p->next;
+		usb_tx_count[ep]--;
+	}
+	hal_irq_restore(primask);
+
+	if (p == NULL)
+		return 0;
+
+	memcpy(buf, p->buf, RAWHID_TX_SIZE);
+	usb_free(p);
+	return 1;
+}
+
+uint8_t sim_usb_due(void)
+{
+	uint8_t n;
+
+	if (!usb_configuration || sim_wire_head == sim_wire_tail)
+		return 0;
+
+	for (n = 0; n < NUM_USB_BUFFERS; n++)
+		if (!usb_pool_used[n])
+			return 1;
+
+	return 0;
+}
+
+uint8_t sim_usb_isr(void)
+{
+	uint32_t ep = RAWHID_RX_ENDPOINT - 1;
+	usb_packet_t *p;
+
+	if (!sim_usb_due())
+		return 0;
+
+	// No buffer means the host is NAKed and tries again later.
+	p = usb_malloc();
+	if (p == NULL)
+		return 0;
+
+	memcpy(p->buf, sim_wire[sim_wire_tail % SIM_WIRE], RAWHID_RX_SIZE);
+	sim_wire_tail++;
+	p->len = RAWHID_RX_SIZE;
+
+	// The callback only sees packets with none queued ahead, as in usb_dev.c.
+	if (usb_rx_callback[ep] && usb_rx_first[ep] == NULL &&
+			usb_rx_callback[ep](RAWHID_RX_ENDPOINT, p))
+		return 1;
+
+	usb_queue(&usb_rx_first[ep], &usb_rx_last[ep], p);
+	return 1;
+}
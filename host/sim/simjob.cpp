@@ -0,0 +1,256 @@
+/* Project: Ewaste 3D Printer
+ * Module: simjob.cpp
+ * Functionality: Runs a compiled job through the host build of the firmware
+ *                and the machine model, in virtual time
+ *
+ * Usage: simjob [options] job.bin
+ *  -x, -y, -z STEPS 	Travel of the simulated machine (default 900, 900, 150)
+ *  -c AXES 			Axes to calibrate before the job, any of xyz (default z)
+ *  -l FILE 			Write the step log to FILE
+ *  -j 				Print the results as JSON, for host/bench/benchmark.py
+ *
+ * The job is a file of 'S' packets from host/gcodec. It is streamed as
+ * motor.stream_file() would, keeping the queue full on the credits in each
+ * trailer. Job time runs from the first packet to the last step or encoder
+ * count, on the simulated clock, so the same firmware and job always give
+ * the same time and the same step log.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <hal.h>
+#include <usb.h>
+#include <commands.h>
+#include <motor.h>
+#include <segment.h>
+#include <crc.h>
+#include <machine.h>
+
+#define TRAVEL_X_DEFAULT 	900
+#define TRAVEL_Y_DEFAULT 	900
+#define TRAVEL_Z_DEFAULT 	150
+
+enum
+{
+	JOB_CALIBRATE, 		// Waiting for the calibration query
+	JOB_SYNC, 			// Waiting for the sequence to restart
+	JOB_STREAM 			// Sending the packets
+};
+
+static std::vector<std::vector<uint8_t> > job_packets;
+static std::string job_calib = "z";
+static uint8_t job_state = JOB_CALIBRATE;
+static size_t job_sent = 0, job_acked = 0;
+static uint8_t job_credits = 0;
+static uint64_t job_start = 0;
+static uint16_t job_calib_result = 0;
+static uint8_t job_json = 0;
+
+static void job_write(const uint8_t *buf)
+{
+	if (!sim_usb_write(buf))
+	{
+		fprintf(stderr, "simjob: wire full\n");
+		exit(1);
+	}
+}
+
+static void job_frame(std::vector<uint8_t> &packet, uint8_t seq)
+{
+	uint16_t crc;
+
+	packet[SEG_HDR_SEQ] = seq;
+	crc = crc16(packet.data(), SEG_CRC);
+	packet[SEG_CRC] = crc & 0xff;
+	packet[SEG_CRC + 1] = crc >> 8;
+}
+
+static void job_read(void)
+{
+	uint8_t buf[BUF_SIZE];
+	size_t delta;
+
+	while (sim_usb_read(buf))
+	{
+		// Every report carries the trailer.
+		job_credits = buf[USB_TRL_CREDITS];
+		if (job_state == JOB_STREAM)
+		{
+			delta = (uint8_t)(buf[USB_TRL_SEQ] - job_acked);
+			if (delta <= job_sent - job_acked)
+				job_acked += delta;
+			continue;
+		}
+		if (buf[USB_TRL_TYPE] != USB_RPT_REPLY)
+			continue;
+
+		if (job_state == JOB_CALIBRATE)
+		{
+			job_calib_result = buf[0] | (buf[1] << 8);
+			job_state = JOB_SYNC;
+		}
+		else if (job_state == JOB_SYNC)
+		{
+			job_state = JOB_STREAM;
+			job_start = sim_now();
+		}
+	}
+}
+
+static void job_host(void)
+{
+	static uint8_t started = 0;
+	std::vector<uint8_t> sync(BUF_SIZE);
+	uint8_t cmd[BUF_SIZE] = {0};
+	size_t i, pending;
+
+	job_read();
+
+	if (!started)
+	{
+		// Calibrations run in order and the query answers after them.
+		started = 1;
+		for (i = 0; i < job_calib.size(); i++)
+		{
+			cmd[0] = CMD_CAL;
+			cmd[1] = toupper(job_calib[i]);
+			job_write(cmd);
+		}
+		cmd[0] = CMD_QRY;
+		cmd[1] = CMD_QRY_C;
+		job_write(cmd);
+
+		// A packet with no segments restarts the sequence at zero.
+		sync[0] = CMD_SEG;
+		job_frame(sync, 0);
+		job_write(sync.data());
+		return;
+	}
+
+	if (job_state != JOB_STREAM)
+		return;
+
+	for (pending = 0, i = job_acked; i < job_sent; i++)
+		pending += job_packets[i][SEG_HDR_COUNT];
+
+	while (job_sent < job_packets.size() && job_sent - job_acked < SEG_WINDOW &&
+			job_packets[job_sent][SEG_HDR_COUNT] + pending <= job_credits)
+	{
+		pending += job_packets[job_sent][SEG_HDR_COUNT];
+		job_write(job_packets[job_sent].data());
+		job_sent++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	mach_config_t config;
+	mach_stats_t stats;
+	std::vector<uint8_t> packet(BUF_SIZE);
+	std::chrono::steady_clock::time_point begin;
+	uint64_t end;
+	double wall, job;
+	FILE *in;
+	int opt;
+
+	memset(&config, 0, sizeof(config));
+	config.travel[X_AXIS] = TRAVEL_X_DEFAULT;
+	config.travel[Y_AXIS] = TRAVEL_Y_DEFAULT;
+	config.travel[Z_AXIS] = TRAVEL_Z_DEFAULT;
+
+	while ((opt = getopt(argc, argv, "x:y:z:c:l:j")) != -1)
+	{
+		switch (opt)
+		{
+			case 'x': config.travel[X_AXIS] = atoi(optarg); break;
+			case 'y': config.travel[Y_AXIS] = atoi(optarg); break;
+			case 'z': config.travel[Z_AXIS] = atoi(optarg); break;
+			case 'c': job_calib = optarg; break;
+			case 'j': job_json = 1; break;
+			case 'l':
+				config.log = fopen(optarg, "w");
+				if (config.log == NULL)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: simjob [-x steps] [-y steps] [-z steps] "
+						"[-c axes] [-l log] [-j] job.bin\n");
+				return 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: simjob [options] job.bin\n");
+		return 1;
+	}
+
+	in = fopen(argv[optind], "rb");
+	if (in == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	while (fread(packet.data(), BUF_SIZE, 1, in) == 1)
+	{
+		job_frame(packet, job_packets.size() + 1);
+		job_packets.push_back(packet);
+	}
+	fclose(in);
+
+	// X and Y start homed, Z somewhere along its travel.
+	config.start[Z_AXIS] = config.travel[Z_AXIS] / 2 + 0.5;
+	mach_init(&config);
+	sim_host = job_host;
+
+	begin = std::chrono::steady_clock::now();
+	setup();
+	while (job_state != JOB_STREAM || job_acked < job_packets.size() || seg_moving())
+		loop();
+	wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	mach_read(&stats);
+	end = (stats.last > job_start) ? stats.last : job_start;
+	job = (end - job_start) / (double)F_CPU;
+
+	if (job_json)
+	{
+		printf("{\"job\": \"%s\", \"packets\": %zu, \"job_s\": %.6f, "
+				"\"steps\": [%u, %u, %u], \"stalls\": [%u, %u, %u], "
+				"\"simulated_s\": %.6f, \"wall_s\": %.6f}\n",
+				argv[optind], job_packets.size(), job,
+				stats.steps[X_AXIS], stats.steps[Y_AXIS], stats.steps[Z_AXIS],
+				stats.stalls[X_AXIS], stats.stalls[Y_AXIS], stats.stalls[Z_AXIS],
+				sim_now() / (double)F_CPU, wall);
+	}
+	else
+	{
+		printf("job        %s, %zu packets\n", argv[optind], job_packets.size());
+		if (!job_calib.empty())
+			printf("calibrated %s, last result %u\n", job_calib.c_str(), job_calib_result);
+		printf("steps      X %u  Y %u  Z %u\n", stats.steps[X_AXIS], stats.steps[Y_AXIS],
+				stats.steps[Z_AXIS]);
+		printf("stalls     X %u  Y %u  Z %u\n", stats.stalls[X_AXIS], stats.stalls[Y_AXIS],
+				stats.stalls[Z_AXIS]);
+		printf("position   X %.0f  Y %.0f  Z %.2f\n", stats.pos[X_AXIS], stats.pos[Y_AXIS],
+				stats.pos[Z_AXIS]);
+		printf("job time   %.6f s\n", job);
+		printf("wall time  %.6f s for %.3f s simulated, %.0fx real time\n", wall,
+				sim_now() / (double)F_CPU, sim_now() / (double)F_CPU / wall);
+	}
+
+	if (config.log)
+		fclose(config.log);
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* Project: Ewaste 3D Printer
+ * Module: usbcheck.cpp
+ * Functionality: Checks that segment packets answered in the USB interrupt
+ *                keep their replies in order and within the transmit limit,
+ *                and that out of range packets are refused, on the host build
+ *
+ * Usage: usbcheck
+ *
+ * The firmware runs with the segment handler from -DSEG_ISR installed,
+ * whether or not it was built with it. An echo command is left to the main
+ * loop, and the next segment packet waits on the wire while interrupts are
+ * masked. It arrives the moment usb_rx() unmasks them to hand the echo to
+ * usb_recv(), as a receive interrupt pending during the dequeue would, and
+ * its reply must still come after the echo's. Then the host stops reading,
+ * and only USB_TX_LIMIT replies may be queued from the interrupt, counted
+ * against the transmit endpoint. Last, a packet whose delta overflows once
+ * repeated must be refused with SEG_RANGE and queue nothing. Every check
+ * prints a line, and the exit status is 1 if any failed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <hal.h>
+#include <usb.h>
+#include <commands.h>
+#include <segment.h>
+#include <crc.h>
+
+#define CHECK_MARK 		0xEC 	// Echo payload, to tell its reply apart
+#define CHECK_LOOPS 	20 		// Main loop passes to let the firmware settle
+
+static int check_failed = 0;
+
+static void check(const char *what, uint32_t got, uint32_t want)
+{
+	printf("%-40s %6u %s\n", what, (unsigned)got, got == want ? "ok" : "FAILED");
+	if (got != want)
+	{
+		printf("%-40s %6u\n", "  expected", (unsigned)want);
+		check_failed = 1;
+	}
+}
+
+static void check_run(void)
+{
+	int i;
+
+	for (i = 0; i < CHECK_LOOPS; i++)
+		loop();
+}
+
+// Next segment packet in sequence, one short X move.
+static void check_segment(uint8_t *buf, uint8_t seq)
+{
+	uint16_t crc;
+
+	memset(buf, 0, BUF_SIZE);
+	buf[0] = CMD_SEG;
+	buf[SEG_HDR_SEQ] = seq;
+	buf[SEG_HDR_COUNT] = 1;
+	buf[SEG_HDR_SIZE] = SEG_FLAG_X;
+	buf[SEG_HDR_SIZE + 1] = 8;
+	crc = crc16(buf, SEG_CRC);
+	buf[SEG_CRC] = crc & 0xff;
+	buf[SEG_CRC + 1] = crc >> 8;
+}
+
+static void check_order(void)
+{
+	uint8_t buf[BUF_SIZE], seq = seg_seq + 1;
+	uint32_t handled = usb_fast_stats.handled;
+
+	memset(buf, 0, sizeof(buf));
+	buf[0] = CMD_ECH;
+	buf[1] = CHECK_MARK;
+	sim_usb_write(buf);
+
+	// What loop() does once ev_wait() returns, with the segment held on the
+	// wire until usb_recv() has the echo.
+	sim_irq_disable();
+	check_segment(buf, seq);
+	sim_usb_write(buf);
+	check("echo taken by usb_recv()", usb_recv() && usb_in_buffer[0] == CMD_ECH, 1);
+	cmd_exec();
+	check_run();
+
+	check("segments answered in the interrupt", usb_fast_stats.handled - handled, 0);
+	check("first reply is the echo", sim_usb_read(buf) && buf[CMD_E_ECHO] == CHECK_MARK, 1);
+	check("second reply is the segment", sim_usb_read(buf) && buf[SEG_RPL_SEQ] == seq, 1);
+	check("segment accepted", buf[SEG_RPL_STATUS], SEG_OK);
+	check("no further replies", sim_usb_read(buf), 0);
+}
+
+static void check_tx_limit(void)
+{
+	uint32_t handled = usb_fast_stats.handled, deferred = usb_fast_stats.deferred;
+	uint8_t buf[BUF_SIZE];
+	int i;
+
+	// The host stops reading, so the replies stay queued.
+	for (i = 0; i <= USB_TX_LIMIT; i++)
+	{
+		check_segment(buf, seg_seq + 1);
+		sim_usb_write(buf);
+		if (i == USB_TX_LIMIT - 1)
+		{
+			check("transmit holds the replies", usb_mem_stats(USB_TX_ENDPOINT)->in_use,
+					USB_TX_LIMIT);
+			check("receive holds none of them", usb_mem_stats(0)->in_use, 0);
+		}
+	}
+
+	check("replies queued in the interrupt", usb_fast_stats.handled - handled, USB_TX_LIMIT);
+	check("packet past the limit deferred", usb_fast_stats.deferred - deferred, 1);
+
+	check_run();
+	while (sim_usb_read(buf));
+	check("pool empty once read", usb_mem_stats(USB_MEM_POOL)->in_use, 0);
+}
+
+static void check_range(void)
+{
+	uint8_t buf[BUF_SIZE], seq = seg_seq + 1, count = seg_count();
+	uint16_t crc;
+
+	// A 2048 step X move repeated 16 times, after one that fits.
+	check_segment(buf, seq);
+	buf[SEG_HDR_COUNT] = 2;
+	buf[SEG_HDR_SIZE + 2] = SEG_FLAG_X | (15 << SEG_REPEAT_SHIFT);
+	buf[SEG_HDR_SIZE + 3] = 0x80;
+	buf[SEG_HDR_SIZE + 4] = 0x20;
+	crc = crc16(buf, SEG_CRC);
+	buf[SEG_CRC] = crc & 0xff;
+	buf[SEG_CRC + 1] = crc >> 8;
+	sim_usb_write(buf);
+	check_run();
+
+	check("out of range reply", sim_usb_read(buf) && buf[SEG_RPL_SEQ] == seq, 1);
+	check("out of range refused", buf[SEG_RPL_STATUS], SEG_RANGE);
+	check("out of range queued nothing", seg_count() - count, 0);
+	check("sequence not advanced", seg_seq, (uint8_t)(seq - 1));
+}
+
+int main(void)
+{
+	uint8_t buf[BUF_SIZE];
+
+	// setup() waits for the host's first packet.
+	memset(buf, 0, sizeof(buf));
+	buf[0] = CMD_QRY;
+	buf[1] = CMD_QRY_V;
+	sim_usb_write(buf);
+	setup();
+	usb_fast(cmd_fast);
+	check_run();
+	while (sim_usb_read(buf));
+
+	check_order();
+	check_tx_limit();
+	check_range();
+
+	return check_failed;
+}
@@ -3,44 +3,106 @@
  * Functionality: Defines constants and functions for decoding USB commands
  */
 
+#include <string.h>
 #include <motor.h>
 #include <usb.h>
 #include <commands.h>
+#include <event.h>
+#include <trace.h>
+#include <jitter.h>
+#include <segment.h>
+#include <telemetry.h>
+#include <gcode.h>
 
-void cmd_exec(void)
+// Result of the last calibration or move, reported by CMD_QRY_C.
+static uint8_t cmd_result[2];
+
+static void cmd_put32(uint8_t *buf, uint32_t val)
 {
-	switch(usb_in_buffer[0])
-	{
-		case CMD_CAL:
-			cmd_cali();
-			break;
+	buf[0] = (uint8_t)(val & 0xff);
+	buf[1] = (uint8_t)((val >> 8) & 0xff);
+	buf[2] = (uint8_t)((val >> 16) & 0xff);
+	buf[3] = (uint8_t)((val >> 24) & 0xff);
+}
 
-		case CMD_MOV:
-			cmd_move();
-			break;
+static constexpr uint8_t cmd_larger(uint8_t a, uint8_t b)
+{
+	return (a > b) ? a : b;
+}
 
-		case CMD_TST:
-			cmd_test();
-			break;
+// Longest query reply
+#define CMD_QRY_REPLY 	cmd_larger(CMD_U_TABLE + CMD_U_ENTRY*(NUM_ENDPOINTS + 1), \
+		CMD_R_SIZE)
 
-		case CMD_HLT:
-			cmd_halt();
-			break;
+// Opcode table, reported to the host by CMD_QRY_V.
+static constexpr cmd_entry_t cmd_table[] =
+{
+	// opcode 	handler 		payload reply 	flags
+	{CMD_CAL, 	cmd_cali, 		1, 		0, 		CMD_F_MOTION},
+	{CMD_ECH, 	cmd_echo, 		CMD_E_LEN, CMD_E_ECHO + CMD_E_LEN, CMD_F_REPLY},
+	{CMD_GCO, 	cmd_gcode, 		BUF_SIZE - 1, 3, CMD_F_REPLY | CMD_F_QUEUE},
+	{CMD_HLT, 	cmd_halt, 		1, 		0, 		0},
+	{CMD_MOV, 	cmd_move, 		5, 		0, 		CMD_F_MOTION},
+	{CMD_QRY, 	cmd_query, 		3, 		CMD_QRY_REPLY, CMD_F_REPLY},
+	{CMD_TEL, 	cmd_telemetry, 	2, 		0, 		0},
+	{CMD_SEG, 	cmd_segment, 	BUF_SIZE - 1, 3, CMD_F_REPLY | CMD_F_QUEUE},
+	{CMD_TST, 	cmd_test, 		1, 		0, 		0},
+};
 
-		case CMD_QRY:
-			cmd_query();
-			usb_send();
-			break;
+#define CMD_COUNT 	(sizeof(cmd_table) / sizeof(cmd_table[0]))
 
-		default:
-			break;
-	}
+static_assert(CMD_V_TABLE + 4*CMD_COUNT <= USB_TRL_TYPE,
+		"opcode table does not fit in the CMD_QRY_V reply");
+static_assert(CMD_QRY_REPLY <= USB_TRL_TYPE, "query replies do not fit");
+static_assert(CMD_T_HIST + 2*TRACE_BUCKETS <= USB_TRL_TYPE,
+		"histogram does not fit in the CMD_QRY_T reply");
+static_assert(CMD_J_HIST + 2*TRACE_BUCKETS <= CMD_QRY_REPLY,
+		"histogram does not fit in the CMD_QRY_J reply");
+
+// Resolved at compile time, so dispatch is a single indexed load.
+static constexpr cmd_handler_t cmd_find(uint8_t opcode, uint8_t i)
+{
+	return (i == CMD_COUNT) ? NULL :
+		(cmd_table[i].opcode == opcode) ? cmd_table[i].handler :
+		cmd_find(opcode, i + 1);
+}
+
+#define CMD_FIND(n) 	cmd_find(CMD_FIRST + (n), 0)
+
+static const cmd_handler_t cmd_dispatch[CMD_SLOTS] =
+{
+	CMD_FIND(0), 	CMD_FIND(1), 	CMD_FIND(2), 	CMD_FIND(3),
+	CMD_FIND(4), 	CMD_FIND(5), 	CMD_FIND(6), 	CMD_FIND(7),
+	CMD_FIND(8), 	CMD_FIND(9), 	CMD_FIND(10), 	CMD_FIND(11),
+	CMD_FIND(12), 	CMD_FIND(13), 	CMD_FIND(14), 	CMD_FIND(15),
+	CMD_FIND(16), 	CMD_FIND(17), 	CMD_FIND(18), 	CMD_FIND(19),
+	CMD_FIND(20), 	CMD_FIND(21), 	CMD_FIND(22), 	CMD_FIND(23),
+	CMD_FIND(24), 	CMD_FIND(25),
+};
+
+cmd_handler_t cmd_lookup(uint8_t opcode)
+{
+	uint8_t slot = opcode - CMD_FIRST;
+
+	return (slot < CMD_SLOTS) ? cmd_dispatch[slot] : NULL;
+}
+
+void cmd_exec(void)
+{
+	cmd_handler_t handler = cmd_lookup(usb_in_buffer[0]);
+
+	// Unknown commands are ignored.
+	if (handler)
+		handler();
 }
 
 void cmd_cali(void)
 {
 	uint16_t calib_steps = 0;
 
+	// Calibration drives the motors directly, so let queued motion finish.
+	seg_drain();
+
 	// Find out which axis to calibrate.
 	switch(usb_in_buffer[1])
 	{
@@ -58,8 +120,8 @@ void cmd_cali(void)
 	}
 
 	// Load the data.
-	usb_out_buffer[0] = (uint8_t)(calib_steps & 0xff);
-	usb_out_buffer[1] = (uint8_t)((calib_steps >> 8) & 0xff);
+	cmd_result[0] = (uint8_t)(calib_steps & 0xff);
+	cmd_result[1] = (uint8_t)((calib_steps >> 8) & 0xff);
 }
 
 void cmd_move(void)
@@ -75,6 +137,13 @@ void cmd_move(void)
 	nsteps = usb_in_buffer[3];
 	step_delay = usb_in_buffer[4] + 256*usb_in_buffer[5];
 
+	// Any other direction would step one way and count the other.
+	if (dir != DIR1 && dir != DIR2)
+		nsteps = 0;
+
+	// Let queued motion finish first.
+	seg_drain();
+
 	// Flag busy.
 	busy();
 	
@@ -100,8 +169,8 @@ void cmd_move(void)
 	idle();
 
 	// Load return data.
-	usb_out_buffer[0] = state;
-	usb_out_buffer[1] = steps;
+	cmd_result[0] = state;
+	cmd_result[1] = steps;
 }
 
 void cmd_test(void)
@@ -145,6 +214,10 @@ void cmd_halt(void)
 
 void cmd_query(void)
 {
+	// Reply is built in place in a tx packet.
+	if (!usb_reply())
+		return;
+
 	switch(usb_in_buffer[1])
 	{
 		case CMD_QRY_S:
@@ -169,7 +242,265 @@ void cmd_query(void)
 			break;
 
 		case CMD_QRY_C:
-			// Nothing to do, as data was loaded when calibration was done.
+			// Data was kept when calibration was done.
+			usb_out_buffer[0] = cmd_result[0];
+			usb_out_buffer[1] = cmd_result[1];
+			break;
+
+		case CMD_QRY_V:
+			cmd_caps();
+			break;
+
+		case CMD_QRY_U:
+			cmd_usb_stats();
+			break;
+
+		case CMD_QRY_I:
+			cmd_fast_stats();
+			break;
+
+		case CMD_QRY_L:
+			cmd_load();
+			break;
+
+		case CMD_QRY_J:
+			cmd_jitter();
+			break;
+
+#ifdef TRACE
+		case CMD_QRY_T:
+		case CMD_QRY_R:
+			cmd_trace();
 			break;
+#endif
+	}
+
+	usb_send();
+}
+
+void cmd_segment(void)
+{
+	uint8_t seq = usb_in_buffer[SEG_HDR_SEQ];
+	uint8_t status;
+
+	// Segments are executed from the main loop. The packet may be held, or
+	// already freed, once this returns.
+	status = seg_accept(usb_in_buffer);
+
+	// Acknowledge the sequence, or ask for the one packet that is missing.
+	if (!usb_reply())
+		return;
+
+	usb_out_buffer[SEG_RPL_STATUS] = status;
+	usb_out_buffer[SEG_RPL_SEQ] = seq;
+	usb_out_buffer[SEG_RPL_MISSING] = seg_seq + 1;
+	usb_send();
+}
+
+uint8_t cmd_fast(uint8_t *buf)
+{
+	uint8_t seq = buf[SEG_HDR_SEQ];
+
+	if (buf[0] != CMD_SEG || !seg_accept_isr(buf))
+		return 0;
+
+	// Same reply as cmd_segment(), written over the command.
+	buf[SEG_RPL_STATUS] = SEG_OK;
+	buf[SEG_RPL_SEQ] = seq;
+	buf[SEG_RPL_MISSING] = seg_seq + 1;
+
+	return 1;
+}
+
+void cmd_telemetry(void)
+{
+	// Report period in milliseconds, zero stops the reports.
+	tel_start(usb_in_buffer[1] + 256*usb_in_buffer[2]);
+}
+
+void cmd_gcode(void)
+{
+	uint8_t len = usb_in_buffer[1];
+
+	// Text follows the length byte, lines may span packets.
+	if (len > BUF_SIZE - 2)
+		len = BUF_SIZE - 2;
+	if (len == 0)
+		gcode_reset();
+	gcode_feed(usb_in_buffer + 2, len);
+
+	if (!usb_reply())
+		return;
+
+	usb_out_buffer[0] = gcode_error;
+	usb_out_buffer[1] = gcode_lines & 0xff;
+	usb_out_buffer[2] = gcode_lines >> 8;
+	usb_send();
+
+	gcode_error = GCODE_OK;
+}
+
+void cmd_echo(void)
+{
+	uint32_t dispatch = micros();
+
+	if (!usb_reply())
+		return;
+
+	cmd_put32(usb_out_buffer + CMD_E_RECV, usb_rx_time);
+	cmd_put32(usb_out_buffer + CMD_E_DISPATCH, dispatch);
+	memcpy(usb_out_buffer + CMD_E_ECHO, usb_in_buffer + 1, CMD_E_LEN);
+
+	// Taken last, so only the commit itself is left out.
+	cmd_put32(usb_out_buffer + CMD_E_SEND, micros());
+	usb_send();
+}
+
+void cmd_usb_stats(void)
+{
+	const usb_mem_stats_t *stats = usb_mem_stats(USB_MEM_POOL);
+	uint8_t ep, *entry;
+	uint16_t fails;
+
+	usb_out_buffer[CMD_U_SIZE] = NUM_USB_BUFFERS;
+	usb_out_buffer[CMD_U_RESERVE] = USB_MEM_RX_RESERVE;
+	usb_out_buffer[CMD_U_IN_USE] = stats->in_use;
+	usb_out_buffer[CMD_U_HIGH] = stats->high_water;
+	cmd_put32(usb_out_buffer + CMD_U_ALLOCS, stats->allocs);
+	cmd_put32(usb_out_buffer + CMD_U_FAILS, stats->fails);
+	usb_out_buffer[CMD_U_COUNT] = NUM_ENDPOINTS + 1;
+
+	for (ep = 0; ep <= NUM_ENDPOINTS; ep++)
+	{
+		stats = usb_mem_stats(ep);
+		entry = usb_out_buffer + CMD_U_TABLE + CMD_U_ENTRY*ep;
+		fails = (stats->fails > 0xffff) ? 0xffff : stats->fails;
+
+		entry[0] = stats->in_use;
+		entry[1] = stats->high_water;
+		entry[2] = stats->quota;
+		entry[3] = (uint8_t)(fails & 0xff);
+		entry[4] = (uint8_t)(fails >> 8);
+	}
+
+	if (usb_in_buffer[2])
+		usb_mem_clear_stats();
+}
+
+void cmd_fast_stats(void)
+{
+	// Cycles at F_CPU, reported in nanoseconds.
+	cmd_put32(usb_out_buffer + CMD_I_HANDLED, usb_fast_stats.handled);
+	cmd_put32(usb_out_buffer + CMD_I_DEFERRED, usb_fast_stats.deferred);
+	cmd_put32(usb_out_buffer + CMD_I_LAST, usb_fast_stats.last*1000/(F_CPU/1000000));
+	cmd_put32(usb_out_buffer + CMD_I_MAX, usb_fast_stats.max*1000/(F_CPU/1000000));
+
+	if (usb_in_buffer[2])
+		usb_fast_clear();
+}
+
+void cmd_load(void)
+{
+	uint32_t window, wakes;
+	uint16_t load = ev_load(&window, &wakes);
+
+	usb_out_buffer[CMD_L_BUSY] = (uint8_t)(load & 0xff);
+	usb_out_buffer[CMD_L_BUSY + 1] = (uint8_t)(load >> 8);
+	cmd_put32(usb_out_buffer + CMD_L_WINDOW, window);
+	cmd_put32(usb_out_buffer + CMD_L_WAKES, wakes);
+}
+
+void cmd_jitter(void)
+{
+	jit_stats_t stats;
+	uint8_t i;
+
+	if (usb_in_buffer[2] >= JIT_AXES)
+		return;
+	jit_read(usb_in_buffer[2], &stats);
+
+	cmd_put32(usb_out_buffer + CMD_J_STEPS, stats.steps);
+	cmd_put32(usb_out_buffer + CMD_J_MISSES, stats.misses);
+	cmd_put32(usb_out_buffer + CMD_J_MAX, stats.max);
+	usb_out_buffer[CMD_J_MHZ] = F_CPU / 1000000;
+	for (i = 0; i < TRACE_BUCKETS; i++)
+	{
+		usb_out_buffer[CMD_J_HIST + 2*i] = (uint8_t)(stats.hist[i] & 0xff);
+		usb_out_buffer[CMD_J_HIST + 2*i + 1] = (uint8_t)(stats.hist[i] >> 8);
+	}
+
+	if (usb_in_buffer[3])
+		jit_clear();
+}
+
+#ifdef TRACE
+void cmd_trace(void)
+{
+	trace_stats_t stats;
+	trace_rec_t recs[CMD_R_MAX];
+	uint8_t src = usb_in_buffer[2], i, n;
+
+	if (src >= TRACE_SOURCES)
+		return;
+	n = trace_read(src, &stats, recs, CMD_R_MAX);
+
+	if (usb_in_buffer[1] == CMD_QRY_R)
+	{
+		usb_out_buffer[CMD_R_COUNT] = n;
+		usb_out_buffer[CMD_R_MHZ] = F_CPU / 1000000;
+		for (i = 0; i < n; i++)
+		{
+			cmd_put32(usb_out_buffer + CMD_R_RECS + 8*i, recs[i].begin);
+			cmd_put32(usb_out_buffer + CMD_R_RECS + 8*i + 4, recs[i].cycles);
+		}
+		return;
+	}
+
+	cmd_put32(usb_out_buffer + CMD_T_COUNT, stats.count);
+	cmd_put32(usb_out_buffer + CMD_T_MIN, stats.min);
+	cmd_put32(usb_out_buffer + CMD_T_MAX, stats.max);
+	cmd_put32(usb_out_buffer + CMD_T_AVG, stats.count ? stats.total / stats.count : 0);
+	usb_out_buffer[CMD_T_MHZ] = F_CPU / 1000000;
+	for (i = 0; i < TRACE_BUCKETS; i++)
+	{
+		usb_out_buffer[CMD_T_HIST + 2*i] = (uint8_t)(stats.hist[i] & 0xff);
+		usb_out_buffer[CMD_T_HIST + 2*i + 1] = (uint8_t)(stats.hist[i] >> 8);
+	}
+
+	if (usb_in_buffer[3])
+		trace_clear();
+}
+#endif
+
+void cmd_caps(void)
+{
+	uint8_t i, *entry;
+
+	usb_out_buffer[CMD_V_MAJOR] = CMD_VERSION_MAJOR;
+	usb_out_buffer[CMD_V_MINOR] = CMD_VERSION_MINOR;
+	usb_out_buffer[CMD_V_QUEUE] = SEG_QUEUE_SIZE;
+	usb_out_buffer[CMD_V_CAPS] = 0;
+#if defined(USB_VENDOR)
+	usb_out_buffer[CMD_V_CAPS] |= CMD_CAP_BULK;
+#endif
+#ifdef USB_STREAM
+	usb_out_buffer[CMD_V_CAPS] |= CMD_CAP_STREAM;
+#endif
+#ifdef SEG_ISR
+	usb_out_buffer[CMD_V_CAPS] |= CMD_CAP_ISR;
+#endif
+#ifdef TRACE
+	usb_out_buffer[CMD_V_CAPS] |= CMD_CAP_TRACE;
+#endif
+	usb_out_buffer[CMD_V_COUNT] = CMD_COUNT;
+
+	// Describe every opcode so hosts can pick formats and batch sizes.
+	for (i = 0; i < CMD_COUNT; i++)
+	{
+		entry = usb_out_buffer + CMD_V_TABLE + 4*i;
+		entry[0] = cmd_table[i].opcode;
+		entry[1] = cmd_table[i].payload;
+		entry[2] = cmd_table[i].reply;
+		entry[3] = cmd_table[i].flags;
 	}
 }
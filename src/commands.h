@@ -6,12 +6,22 @@
 #ifndef COMMANDS_H_
 #define COMMANDS_H_
 
+#include <stdint.h>
+
+// Protocol version reported by CMD_QRY_V
+#define CMD_VERSION_MAJOR 	2
+#define CMD_VERSION_MINOR 	4
+
 // First byte for class of command
 #define CMD_CAL 	'C' 	// Calibrations
 #define CMD_MOV 	'M' 	// Move
 #define CMD_TST 	'T' 	// Testing motor
 #define CMD_HLT 	'H' 	// Halt motor
 #define CMD_QRY 	'Q' 	// Queries for the machine
+#define CMD_SEG 	'S' 	// Compact motion segments
+#define CMD_TEL 	'R' 	// Telemetry report rate
+#define CMD_GCO 	'G' 	// G-code text
+#define CMD_ECH 	'E' 	// Latency probe
 
 // Second byte for specifics of the command
 #define CMD_CAL_X 	'X' 	// Calibrate X
@@ -33,12 +43,122 @@
 #define CMD_QRY_S 	'S' 	// Switch statuses
 #define CMD_QRY_P 	'P' 	// Position of the motors
 #define CMD_QRY_C 	'C' 	// Calibration query
+#define CMD_QRY_V 	'V' 	// Version and capabilities
+#define CMD_QRY_U 	'U' 	// USB buffer pool usage
+#define CMD_QRY_I 	'I' 	// Segments decoded in the USB interrupt
+#define CMD_QRY_L 	'L' 	// CPU load of the main loop
+#define CMD_QRY_T 	'T' 	// Interrupt timing statistics
+#define CMD_QRY_R 	'R' 	// Latest interrupt trace records
+#define CMD_QRY_J 	'J' 	// Step edge jitter
+
+// Opcodes are upper case letters, dispatched through a lookup table
+#define CMD_FIRST 	'A'
+#define CMD_SLOTS 	26
+
+// Opcode flags
+#define CMD_F_REPLY 	0x01 	// Always answers with a reply
+#define CMD_F_MOTION 	0x02 	// Moves the machine before returning
+#define CMD_F_QUEUE 	0x04 	// Feeds the motion queue
+
+// Build features reported by CMD_QRY_V
+#define CMD_CAP_BULK 	0x01 	// Vendor bulk transport
+#define CMD_CAP_STREAM 	0x02 	// CDC serial telemetry stream
+#define CMD_CAP_ISR 	0x04 	// Segments decoded in the USB interrupt
+#define CMD_CAP_TRACE 	0x08 	// Interrupt tracing
+
+// CMD_QRY_V reply layout
+#define CMD_V_MAJOR 	0 		// Protocol major version
+#define CMD_V_MINOR 	1 		// Protocol minor version
+#define CMD_V_QUEUE 	2 		// Motion queue slots
+#define CMD_V_CAPS 		3 		// CMD_CAP_* bits
+#define CMD_V_COUNT 	4 		// Number of opcode entries
+#define CMD_V_TABLE 	5 		// Entries of opcode, payload, reply, flags
+
+// CMD_QRY_U reply layout, counters little endian. A non-zero third command
+// byte restarts the counters once they are reported.
+#define CMD_U_SIZE 		0 		// Buffers in the pool
+#define CMD_U_RESERVE 	1 		// Buffers kept for receive
+#define CMD_U_IN_USE 	2 		// Buffers held now
+#define CMD_U_HIGH 		3 		// Most buffers held at once
+#define CMD_U_ALLOCS 	4 		// Allocations, 4 bytes
+#define CMD_U_FAILS 	8 		// Refused allocations, 4 bytes
+#define CMD_U_COUNT 	12 		// Number of endpoint entries
+#define CMD_U_TABLE 	13 		// Entries from endpoint 0, which counts receive
+#define CMD_U_ENTRY 	5 		// In use, high water, quota, fails (2 bytes)
+
+// CMD_ECH reply layout, times are micros() little endian
+#define CMD_E_RECV 		0 		// Packet taken from the USB stack
+#define CMD_E_DISPATCH 	4 		// Handler started
+#define CMD_E_SEND 		8 		// Reply handed to the USB stack
+#define CMD_E_ECHO 		12 		// Payload bytes echoed back
+#define CMD_E_LEN 		(USB_TRL_TYPE - CMD_E_ECHO) 	// Bytes echoed
+
+// CMD_QRY_I reply layout, little endian. A non-zero third command byte
+// restarts the counters once they are reported.
+#define CMD_I_HANDLED 	0 		// Packets answered in the interrupt
+#define CMD_I_DEFERRED 	4 		// Packets left to the main loop
+#define CMD_I_LAST 		8 		// Nanoseconds taken by the last packet
+#define CMD_I_MAX 		12 		// Most nanoseconds taken by one packet
+
+// CMD_QRY_L reply layout, little endian. Each query starts a new window.
+#define CMD_L_BUSY 		0 		// Per mille of the window awake, 2 bytes
+#define CMD_L_WINDOW 	2 		// Microseconds since the last query
+#define CMD_L_WAKES 	6 		// Interrupts that woke the main loop
+
+// CMD_QRY_T reply layout for the TRACE_* handler in the third command byte,
+// cycles at F_CPU and little endian. A non-zero fourth command byte restarts
+// every handler once this one is reported.
+#define CMD_T_COUNT 	0 		// Records
+#define CMD_T_MIN 		4 		// Shortest
+#define CMD_T_MAX 		8 		// Longest
+#define CMD_T_AVG 		12 		// Average
+#define CMD_T_MHZ 		16 		// Cycles per microsecond
+#define CMD_T_HIST 		17 		// TRACE_BUCKETS counts of 2 bytes
+
+// CMD_QRY_R reply layout for the TRACE_* handler in the third command byte
+#define CMD_R_COUNT 	0 		// Records that follow, oldest first
+#define CMD_R_MHZ 		1 		// Cycles per microsecond
+#define CMD_R_RECS 		2 		// Entry cycle count and length, 4 bytes each
+#define CMD_R_MAX 		7 		// Most records in one reply
+#define CMD_R_SIZE 		(CMD_R_RECS + 8*CMD_R_MAX)
+
+// CMD_QRY_J reply layout for the axis in the third command byte, 0 for X and
+// 1 for Y, cycles at F_CPU and little endian. A non-zero fourth command byte
+// restarts both axes once this one is reported.
+#define CMD_J_STEPS 	0 		// Step edges measured
+#define CMD_J_MISSES 	4 		// Edges a step period or more late
+#define CMD_J_MAX 		8 		// Latest edge
+#define CMD_J_MHZ 		12 		// Cycles per microsecond
+#define CMD_J_HIST 		13 		// TRACE_BUCKETS counts of 2 bytes
+
+typedef void (*cmd_handler_t)(void);
+
+typedef struct
+{
+	uint8_t opcode; 			// First byte of the command
+	cmd_handler_t handler; 		// Function executing it
+	uint8_t payload; 			// Bytes used after the opcode
+	uint8_t reply; 				// Bytes used in the reply
+	uint8_t flags; 				// CMD_F_* bits
+} cmd_entry_t;
 
 void cmd_exec(void); 		// Master command execution function
+cmd_handler_t cmd_lookup(uint8_t opcode); 	// Handler of an opcode, or NULL
 void cmd_cali(void); 		// Function to execute calibration comands
 void cmd_move(void);  		// Function to execute move commands		
 void cmd_test(void); 		// Function to execute motor test commands
 void cmd_halt(void); 		// Function to execute motor halt commands
 void cmd_query(void); 		// Function to get query from machine
+void cmd_segment(void); 	// Function to queue compact motion segments
+void cmd_telemetry(void); 	// Function to set the telemetry report rate
+void cmd_gcode(void); 		// Function to feed G-code text
+void cmd_echo(void); 		// Function to answer a latency probe
+void cmd_usb_stats(void); 	// Function to report USB buffer pool usage
+void cmd_caps(void); 		// Function to describe version and opcodes
+void cmd_fast_stats(void); 	// Function to report interrupt decode timing
+void cmd_load(void); 		// Function to report main loop CPU load
+void cmd_trace(void); 		// Function to report interrupt timing
+void cmd_jitter(void); 		// Function to report step edge jitter
+uint8_t cmd_fast(uint8_t *buf); 	// Answer a segment packet in the interrupt
 
 #endif
@@ -0,0 +1,37 @@
+/* Project: Ewaste 3D Printer
+ * Module: crc.cpp
+ * Functionality: Table driven CRC for streamed packets
+ */
+
+#include <crc.h>
+
+// One bit of the shift register, applied eight times per table entry.
+static constexpr uint16_t crc_bits(uint16_t crc, uint8_t n)
+{
+	return (n == 0) ? crc :
+		crc_bits((crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC_POLY) :
+			(uint16_t)(crc << 1), n - 1);
+}
+
+#define CRC_E(n) 		crc_bits((uint16_t)((n) << 8), 8)
+#define CRC_E4(n) 		CRC_E(n), CRC_E(n + 1), CRC_E(n + 2), CRC_E(n + 3)
+#define CRC_E16(n) 		CRC_E4(n), CRC_E4(n + 4), CRC_E4(n + 8), CRC_E4(n + 12)
+#define CRC_E64(n) 		CRC_E16(n), CRC_E16(n + 16), CRC_E16(n + 32), CRC_E16(n + 48)
+
+// Generated by the compiler and kept in flash.
+static const uint16_t crc_table[256] =
+{
+	CRC_E64(0), CRC_E64(64), CRC_E64(128), CRC_E64(192)
+};
+
+static_assert(CRC_E(1) == CRC_POLY, "CRC table generator is broken");
+
+uint16_t crc16(const uint8_t *buf, uint8_t len)
+{
+	uint16_t crc = CRC_INIT;
+
+	while (len--)
+		crc = (uint16_t)(crc << 8) ^ crc_table[(crc >> 8) ^ *buf++];
+
+	return crc;
+}
@@ -0,0 +1,20 @@
+/* Project: Ewaste 3D Printer
+ * Module: crc.h
+ * Functionality: Defines the CRC used to check streamed packets
+ *
+ * CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, no reflection
+ * and no final XOR. The check value of "123456789" is 0x29B1.
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stdint.h>
+
+#define CRC_POLY 			0x1021 	// Generator polynomial
+#define CRC_INIT 			0xFFFF 	// Initial value
+#define CRC_SIZE 			2 		// Bytes, stored little endian
+
+uint16_t crc16(const uint8_t *buf, uint8_t len); 	// CRC of a buffer
+
+#endif
@@ -0,0 +1,81 @@
+/* Project: Ewaste 3D Printer
+ * Module: event.cpp
+ * Functionality: Posts events from interrupts and sleeps the main loop
+ *                until they arrive
+ */
+
+#include <hal.h>
+#include <event.h>
+
+static volatile uint8_t ev_flags[EV_COUNT];
+
+// Time asleep since the last ev_load(), main loop only
+static uint64_t ev_asleep = 0; 		// Cycles at F_CPU
+static uint32_t ev_wakes = 0; 		// Sleeps ended by an interrupt
+static uint32_t ev_since = 0; 		// micros() when the window opened
+
+void FASTRUN ev_post(uint8_t ev)
+{
+	ev_flags[ev] = 1;
+}
+
+uint8_t ev_take(uint8_t ev)
+{
+	if (!ev_flags[ev])
+		return 0;
+
+	ev_flags[ev] = 0;
+	return 1;
+}
+
+// Called with interrupts disabled. WFI still wakes on a pending interrupt,
+// which then runs as soon as they are enabled again.
+static void ev_wfi(void)
+{
+	uint32_t begin = hal_tick();
+
+	hal_wfi();
+
+	// SysTick wraps every millisecond and its interrupt wakes the core, so
+	// one sleep never spans more than one wrap.
+	ev_asleep += hal_tick_cycles(begin);
+	ev_wakes++;
+}
+
+void ev_wait(void)
+{
+	uint8_t i;
+
+	__disable_irq();
+	for (i = 0; i < EV_COUNT; i++)
+		if (ev_flags[i])
+			break;
+	if (i == EV_COUNT)
+		ev_wfi();
+	__enable_irq();
+}
+
+void ev_sleep(void)
+{
+	__disable_irq();
+	ev_wfi();
+	__enable_irq();
+}
+
+uint16_t ev_load(uint32_t *window, uint32_t *wakes)
+{
+	uint32_t now = micros();
+	uint32_t asleep = ev_asleep / (F_CPU / 1000000);
+	uint16_t load;
+
+	*window = now - ev_since;
+	*wakes = ev_wakes;
+	load = (*window && asleep < *window) ?
+			1000 - (uint16_t)((uint64_t)asleep*1000 / *window) : 0;
+
+	ev_since = now;
+	ev_asleep = 0;
+	ev_wakes = 0;
+
+	return load;
+}
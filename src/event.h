@@ -0,0 +1,30 @@
+/* Project: Ewaste 3D Printer
+ * Module: event.h
+ * Functionality: Defines the events interrupts post to the main loop, and
+ *                the sleep that waits for them
+ *
+ * Each event is a flag of its own, so posting from an interrupt is a single
+ * byte store. The main loop clears a flag before handling it and handlers
+ * work through everything pending, so an event posted twice before it is
+ * seen needs no counting.
+ */
+
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include <stdint.h>
+
+#define EV_USB_RX 		0 		// Packets waiting in usb_recv()
+#define EV_LOW_WATER 	1 		// Motion queue drained to SEG_LOW_WATER
+#define EV_TELEMETRY 	2 		// Telemetry report due
+#define EV_COUNT 		3 		// Number of events
+
+void ev_post(uint8_t ev); 		// Post an event, safe from interrupts
+uint8_t ev_take(uint8_t ev); 	// Clear an event, non-zero if it was posted
+void ev_wait(void); 			// Sleep for one interrupt unless an event is posted
+void ev_sleep(void); 			// Sleep for one interrupt
+
+// Per mille of time awake since the last call, over a window in microseconds
+uint16_t ev_load(uint32_t *window, uint32_t *wakes);
+
+#endif
@@ -0,0 +1,476 @@
+/* Project: Ewaste 3D Printer
+ * Module: gcode.cpp
+ * Functionality: Streaming G-code interpreter feeding the motion queue
+ */
+
+#include <stdlib.h>
+#include <motor.h>
+#include <event.h>
+#include <segment.h>
+#include <gcode.h>
+
+// Parser states
+#define GC_LINE 		0 		// Between words
+#define GC_NUM_START 	1 		// After a letter, before any digit
+#define GC_NUM_INT 		2 		// Integer digits
+#define GC_NUM_FRAC 	3 		// Digits after the point
+#define GC_COMMENT 		4 		// Skipping to the end of the line
+#define GC_PAREN 		5 		// Inside a parenthesised comment
+
+// Words kept for the line being parsed
+#define GW_X 			0
+#define GW_Y 			1
+#define GW_Z 			2
+#define GW_F 			3
+#define GW_G 			4
+#define GW_M 			5
+#define GW_COUNT 		6
+#define GW_SKIP 		0xff 	// Word that is parsed but not used
+
+#define GC_NONE 		0xffff 	// No G or M code on the line
+
+#define NUM_AXES 		3
+
+// Parser, only the current word and line are held
+static uint8_t gc_state = GC_LINE;
+static uint8_t gc_word = GW_SKIP;
+static uint8_t gc_neg, gc_digits, gc_frac;
+static int32_t gc_num;
+static uint8_t gc_seen;
+static uint8_t gc_words; 				// Line has at least one word
+static uint8_t gc_bad; 					// Line has an error and is skipped
+static int32_t gc_val[GW_COUNT];
+static uint16_t gc_gcode = GC_NONE;
+static uint16_t gc_mcode = GC_NONE;
+static uint16_t gc_units = GC_NONE; 	// G20 or G21 on the line
+static uint16_t gc_distance = GC_NONE; 	// G90 or G91 on the line
+
+// Modal state
+static uint8_t gc_relative = 0;
+static uint8_t gc_inches = 0;
+static int32_t gc_feed = GCODE_FEED_DEFAULT;
+static int32_t gc_pos[NUM_AXES]; 			// Machine position, micrometres
+static int32_t gc_offset[NUM_AXES]; 		// Machine minus work position
+static int32_t gc_steps[NUM_AXES]; 			// Machine position, steps
+static int32_t gc_spm[NUM_AXES] = {GCODE_SPM_X, GCODE_SPM_Y, GCODE_SPM_Z};
+
+uint8_t gcode_error = GCODE_OK;
+uint16_t gcode_lines = 0;
+
+static void gcode_line_reset(void)
+{
+	gc_state = GC_LINE;
+	gc_word = GW_SKIP;
+	gc_seen = 0;
+	gc_words = 0;
+	gc_bad = 0;
+	gc_gcode = GC_NONE;
+	gc_mcode = GC_NONE;
+	gc_units = GC_NONE;
+	gc_distance = GC_NONE;
+}
+
+void gcode_reset(void)
+{
+	gcode_line_reset();
+}
+
+// Convert a parsed length to micrometres. Inches can take it past int32_t.
+static int64_t gcode_length(int32_t val)
+{
+	if (gc_inches)
+		return (int64_t)val * GCODE_INCH / GCODE_UNIT;
+	return val;
+}
+
+static int64_t gcode_to_steps(uint8_t axis, int64_t um)
+{
+	return um * gc_spm[axis] / (GCODE_UNIT * GCODE_UNIT);
+}
+
+static uint8_t gcode_in_range(int64_t val, int64_t max)
+{
+	return val >= -max && val <= max;
+}
+
+static uint32_t gcode_isqrt(uint64_t val)
+{
+	uint64_t res = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+
+	while (bit > val)
+		bit >>= 2;
+
+	while (bit)
+	{
+		if (val >= res + bit)
+		{
+			val -= res + bit;
+			res = (res >> 1) + bit;
+		}
+		else
+			res >>= 1;
+		bit >>= 2;
+	}
+
+	return (uint32_t)res;
+}
+
+// Sleep until the step interrupt makes room in the motion queue.
+static void gcode_push(const segment_t *seg)
+{
+	while (seg_free() == 0)
+		ev_sleep();
+
+	seg_push(seg);
+}
+
+// Steps of one of nparts pieces of a move, which add up to delta.
+static int16_t gcode_part(int32_t delta, int32_t part, int32_t nparts)
+{
+	return (int16_t)((int64_t)delta*(part + 1)/nparts - (int64_t)delta*part/nparts);
+}
+
+static void gcode_move(uint8_t rapid)
+{
+	int64_t target[NUM_AXES], steps[NUM_AXES];
+	int32_t delta[NUM_AXES], dx, dy, nsteps, largest, nparts, part;
+	uint64_t time_us, delay;
+	uint32_t dist;
+	segment_t seg;
+	uint8_t i;
+
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		target[i] = gc_pos[i];
+		if (gc_seen & (1 << i))
+		{
+			if (gc_relative)
+				target[i] += gcode_length(gc_val[i]);
+			else
+				target[i] = gcode_length(gc_val[i]) + gc_offset[i];
+		}
+
+		// Steps come from absolute positions so rounding never accumulates.
+		steps[i] = gcode_to_steps(i, target[i]);
+
+		// Within these every difference below fits in int32_t.
+		if (!gcode_in_range(target[i], GCODE_POS_MAX) ||
+				!gcode_in_range(steps[i], GCODE_STEPS_MAX))
+		{
+			gcode_error = GCODE_E_RANGE;
+			return;
+		}
+		delta[i] = (int32_t)(steps[i] - gc_steps[i]);
+	}
+
+	// Feed is along the XY path, or along Z for a plunge.
+	dx = (int32_t)(target[X_AXIS] - gc_pos[X_AXIS]);
+	dy = (int32_t)(target[Y_AXIS] - gc_pos[Y_AXIS]);
+	dist = gcode_isqrt((uint64_t)((int64_t)dx*dx + (int64_t)dy*dy));
+	if (dist == 0)
+		dist = (uint32_t)abs((int32_t)(target[Z_AXIS] - gc_pos[Z_AXIS]));
+
+	nsteps = abs(delta[X_AXIS]) > abs(delta[Y_AXIS]) ?
+		abs(delta[X_AXIS]) : abs(delta[Y_AXIS]);
+
+	delay = GCODE_RAPID_DELAY;
+	if (!rapid && nsteps)
+	{
+		time_us = (uint64_t)dist * 60000000ULL / gc_feed;
+		delay = time_us / nsteps;
+		if (delay < GCODE_MIN_DELAY)
+			delay = GCODE_MIN_DELAY;
+		if (delay > 0xffff)
+			delay = 0xffff;
+	}
+	seg.step_delay = (uint16_t)delay;
+
+	// Long moves are split to fit the segment deltas.
+	largest = nsteps > abs(delta[Z_AXIS]) ? nsteps : abs(delta[Z_AXIS]);
+	nparts = largest / SEG_DELTA_MAX + 1;
+	for (part = 0; part < nparts; part++)
+	{
+		seg.dx = gcode_part(delta[X_AXIS], part, nparts);
+		seg.dy = gcode_part(delta[Y_AXIS], part, nparts);
+		seg.dz = gcode_part(delta[Z_AXIS], part, nparts);
+		gcode_push(&seg);
+	}
+
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		gc_pos[i] = (int32_t)target[i];
+		gc_steps[i] = (int32_t)steps[i];
+	}
+}
+
+static void gcode_home(void)
+{
+	uint8_t i;
+
+	seg_drain();
+	motor_home();
+
+	for (i = 0; i < NUM_AXES; i++)
+		gc_pos[i] = gc_steps[i] = 0;
+}
+
+static void gcode_set_position(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < NUM_AXES; i++)
+		if (gc_seen & (1 << i) && !gcode_in_range(gcode_length(gc_val[i]), GCODE_POS_MAX))
+		{
+			gcode_error = GCODE_E_RANGE;
+			return;
+		}
+
+	// Without axis words every axis becomes zero.
+	for (i = 0; i < NUM_AXES; i++)
+	{
+		if (gc_seen & (1 << i))
+			gc_offset[i] = gc_pos[i] - (int32_t)gcode_length(gc_val[i]);
+		else if ((gc_seen & ((1 << NUM_AXES) - 1)) == 0)
+			gc_offset[i] = gc_pos[i];
+	}
+}
+
+static void gcode_exec_line(void)
+{
+	int64_t feed;
+	uint8_t i;
+
+	// Modal codes apply before the rest of the line, and only once the
+	// whole line has parsed.
+	if (gc_units != GC_NONE)
+		gc_inches = (gc_units == 20);
+	if (gc_distance != GC_NONE)
+		gc_relative = (gc_distance == 91);
+
+	if (gc_seen & (1 << GW_F) && gc_val[GW_F] > 0)
+	{
+		feed = gcode_length(gc_val[GW_F]);
+		gc_feed = (feed < GCODE_NUM_MAX) ? (int32_t)feed : GCODE_NUM_MAX;
+	}
+
+	switch (gc_mcode)
+	{
+		case 92:
+			// Steps per mm, in thousandths like every other number.
+			for (i = 0; i < NUM_AXES; i++)
+				if (gc_seen & (1 << i) && gc_val[i] > 0)
+					gc_spm[i] = gc_val[i];
+			break;
+
+		case 400:
+			seg_drain();
+			break;
+	}
+
+	switch (gc_gcode)
+	{
+		case 0:
+			gcode_move(1);
+			break;
+
+		case 1:
+			gcode_move(0);
+			break;
+
+		case 28:
+			gcode_home();
+			break;
+
+		case 92:
+			gcode_set_position();
+			break;
+	}
+}
+
+// Called once a G word is complete, modal codes wait for gcode_exec_line().
+static void gcode_gword(int32_t val)
+{
+	if (val % GCODE_UNIT)
+	{
+		gcode_error = GCODE_E_CODE;
+		gc_bad = 1;
+		return;
+	}
+
+	switch (val / GCODE_UNIT)
+	{
+		case 20:
+		case 21:
+			gc_units = val / GCODE_UNIT;
+			break;
+
+		case 90:
+		case 91:
+			gc_distance = val / GCODE_UNIT;
+			break;
+
+		case 0:
+		case 1:
+		case 28:
+		case 92:
+			gc_gcode = val / GCODE_UNIT;
+			break;
+
+		default:
+			gcode_error = GCODE_E_CODE;
+			gc_bad = 1;
+			break;
+	}
+}
+
+static void gcode_end_word(void)
+{
+	int32_t val;
+
+	if (gc_state < GC_NUM_START || gc_state > GC_NUM_FRAC)
+		return;
+	gc_state = GC_LINE;
+
+	if (gc_digits == 0)
+	{
+		gcode_error = GCODE_E_WORD;
+		gc_bad = 1;
+		return;
+	}
+
+	// Scale to fixed point, saturating rather than overflowing.
+	val = gc_num;
+	for (; gc_frac < GCODE_FRAC_DIGITS; gc_frac++)
+		val = (val < GCODE_NUM_MAX / 10) ? 10*val : GCODE_NUM_MAX;
+	if (gc_neg)
+		val = -val;
+
+	switch (gc_word)
+	{
+		case GW_G:
+			gcode_gword(val);
+			break;
+
+		case GW_M:
+			if (val >= 0 && val % GCODE_UNIT == 0 && val / GCODE_UNIT < GC_NONE)
+				gc_mcode = val / GCODE_UNIT;
+			if (gc_mcode == 92 || gc_mcode == 400)
+				break;
+			gc_mcode = GC_NONE;
+			break;
+
+		case GW_SKIP:
+			break;
+
+		default:
+			gc_val[gc_word] = val;
+			gc_seen |= 1 << gc_word;
+			break;
+	}
+}
+
+static uint8_t gcode_word_index(uint8_t c)
+{
+	switch (c)
+	{
+		case 'X': return GW_X;
+		case 'Y': return GW_Y;
+		case 'Z': return GW_Z;
+		case 'F': return GW_F;
+		case 'G': return GW_G;
+		case 'M': return GW_M;
+	}
+	return GW_SKIP;
+}
+
+void gcode_feed(const uint8_t *buf, uint8_t len)
+{
+	uint8_t c;
+
+	while (len--)
+	{
+		c = *buf++;
+
+		if (c == '\n' || c == '\r')
+		{
+			gcode_end_word();
+			if (gc_words)
+			{
+				if (!gc_bad)
+					gcode_exec_line();
+				gcode_lines++;
+			}
+			gcode_line_reset();
+			continue;
+		}
+
+		if (gc_state == GC_COMMENT)
+			continue;
+
+		if (gc_state == GC_PAREN)
+		{
+			if (c == ')')
+				gc_state = GC_LINE;
+			continue;
+		}
+
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+
+		if (c >= '0' && c <= '9' && gc_state >= GC_NUM_START)
+		{
+			gc_digits++;
+			if (gc_state == GC_NUM_FRAC)
+			{
+				// Further decimals are below our resolution.
+				if (gc_frac == GCODE_FRAC_DIGITS)
+					continue;
+				gc_frac++;
+			}
+			else
+				gc_state = GC_NUM_INT;
+
+			if (gc_num < GCODE_NUM_MAX / 10)
+				gc_num = 10*gc_num + (c - '0');
+			continue;
+		}
+
+		if (c == '.' && (gc_state == GC_NUM_START || gc_state == GC_NUM_INT))
+		{
+			gc_state = GC_NUM_FRAC;
+			continue;
+		}
+
+		if ((c == '-' || c == '+') && gc_state == GC_NUM_START && gc_digits == 0)
+		{
+			gc_neg = (c == '-');
+			continue;
+		}
+
+		if ((c == ' ' || c == '\t') && gc_state == GC_NUM_START)
+			continue;
+
+		gcode_end_word();
+
+		if (c >= 'A' && c <= 'Z')
+		{
+			gc_word = gcode_word_index(c);
+			gc_words = 1;
+			gc_state = GC_NUM_START;
+			gc_num = 0;
+			gc_neg = 0;
+			gc_digits = 0;
+			gc_frac = 0;
+		}
+		else if (c == ';' || c == '*')
+			gc_state = GC_COMMENT;
+		else if (c == '(')
+			gc_state = GC_PAREN;
+		else if (c != ' ' && c != '\t')
+		{
+			gcode_error = GCODE_E_WORD;
+			gc_bad = 1;
+		}
+	}
+}
@@ -0,0 +1,48 @@
+/* Project: Ewaste 3D Printer
+ * Module: gcode.h
+ * Functionality: Defines the streaming G-code interpreter feeding the motion
+ *                queue
+ *
+ * Bytes may be split anywhere across packets. Lines are parsed as they
+ * arrive without being stored, so memory use is fixed. Supported are G0, G1,
+ * G20, G21, G28, G90, G91, G92, M92 and M400. Other M-codes are accepted and
+ * ignored, other G-codes are flagged as errors. A line with an error is
+ * skipped whole, modal codes on it included. Moves and G92 positions past
+ * GCODE_POS_MAX or GCODE_STEPS_MAX are refused with GCODE_E_RANGE.
+ */
+
+#ifndef GCODE_H_
+#define GCODE_H_
+
+#include <stdint.h>
+
+// Fixed point: lengths in micrometres, feeds in micrometres per minute and
+// steps per mm in thousandths
+#define GCODE_FRAC_DIGITS 	3 			// Decimal places kept
+#define GCODE_UNIT 			1000 		// One mm in fixed point
+#define GCODE_NUM_MAX 		100000000 	// Numbers saturate here
+#define GCODE_INCH 			25400 		// Micrometres in an inch
+#define GCODE_POS_MAX 		GCODE_NUM_MAX 	// Furthest position in micrometres
+#define GCODE_STEPS_MAX 	0x3fffffff 	// Furthest position in steps
+
+#define GCODE_SPM_X 		24000 		// Default X steps per mm
+#define GCODE_SPM_Y 		24000 		// Default Y steps per mm
+#define GCODE_SPM_Z 		4000 		// Default Z steps per mm
+
+#define GCODE_FEED_DEFAULT 	600000 		// G1 feed until F is given
+#define GCODE_RAPID_DELAY 	600 		// G0 step interval in microseconds
+#define GCODE_MIN_DELAY 	100 		// Fastest step interval
+
+// Error codes, the last one is kept until reported
+#define GCODE_OK 			0
+#define GCODE_E_CODE 		1 			// Unsupported G-code
+#define GCODE_E_WORD 		2 			// Malformed word
+#define GCODE_E_RANGE 		3 			// Position out of range, not moved
+
+void gcode_reset(void); 					// Forget any partial line
+void gcode_feed(const uint8_t *buf, uint8_t len); 	// Parse more bytes
+
+extern uint8_t gcode_error; 				// Last error, GCODE_E_*
+extern uint16_t gcode_lines; 				// Lines executed
+
+#endif
@@ -0,0 +1,95 @@
+/* Project: Ewaste 3D Printer
+ * Module: hal.h
+ * Functionality: Hardware used by the firmware, from the Teensy core or,
+ *                with -DHOST_BUILD, from the simulated backend in host/sim
+ *
+ * Sources include this rather than Teensy headers. Pins, delays, timers and
+ * the USB packet layer keep their Teensy names, so the backend provides
+ * those same calls. The few things that were registers or instructions are
+ * the hal_ functions below:
+ *  hal_tick() 			SysTick, counting down from SYST_RVR every millisecond
+ *  hal_tick_cycles() 	Cycles since a hal_tick() reading, at most one wrap
+ *  hal_cycles() 		Free running cycle count, on Teensy 3.x and the host
+ *  hal_clock() 		Cycles since start in 64 bits, so it never wraps. Read
+ * 						without masking interrupts, safe from any handler
+ *  hal_irq_save() 		Disable interrupts, returning the mask to restore
+ *  hal_irq_restore() 	Put back what hal_irq_save() returned
+ *  hal_wfi() 			Sleep until an interrupt, called with them disabled
+ *
+ * Functions marked FASTRUN are linked into .fastrun, copied to RAM with the
+ * initialised data at startup. Flash on the LC runs at half the core clock
+ * with wait states, so interrupt handlers and everything they call run from
+ * there, and toggle pins with digitalWriteFast() rather than calling into
+ * the core in flash.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+#ifdef HOST_BUILD
+#include <sim.h>
+#else
+#include <core_pins.h>
+#include <IntervalTimer.h>
+#include <usb_dev.h>
+
+#if defined(USB_VENDOR)
+#include <usb_vendor.h>
+#else
+#include <usb_rawhid.h>
+#endif
+
+#if defined(USB_RAWHID_SERIAL)
+#include <usb_serial.h>
+#endif
+
+static inline uint32_t hal_tick(void)
+{
+	return SYST_CVR;
+}
+
+static inline uint32_t hal_tick_cycles(uint32_t begin)
+{
+	uint32_t cycles = begin - SYST_CVR;
+
+	// SysTick counts down and wraps every millisecond.
+	if (cycles > SYST_RVR)
+		cycles += SYST_RVR + 1;
+
+	return cycles;
+}
+
+static inline uint64_t hal_clock(void)
+{
+	return cycles64();
+}
+
+#if defined(KINETISK)
+static inline uint32_t hal_cycles(void)
+{
+	return ARM_DWT_CYCCNT;
+}
+#endif
+
+static inline uint32_t hal_irq_save(void)
+{
+	uint32_t primask;
+
+	__asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+	return primask;
+}
+
+static inline void hal_irq_restore(uint32_t primask)
+{
+	__asm__ volatile("msr primask, %0" :: "r" (primask) : "memory");
+}
+
+static inline void hal_wfi(void)
+{
+	__asm__ volatile("wfi");
+}
+#endif
+
+#endif
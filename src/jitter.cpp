@@ -0,0 +1,50 @@
+/* Project: Ewaste 3D Printer
+ * Module: jitter.cpp
+ * Functionality: Measures how late step edges come against the step timer
+ */
+
+#include <string.h>
+#include <hal.h>
+#include <motor.h>
+#include <jitter.h>
+
+static jit_stats_t jit_axis[JIT_AXES];
+
+void FASTRUN jit_record(uint8_t mask, uint32_t late, uint32_t period)
+{
+	jit_stats_t *s;
+	uint16_t *bucket;
+	uint8_t axis;
+
+	for (axis = 0; axis < JIT_AXES; axis++)
+	{
+		if (!(mask & (MOTOR_STEP_X << axis)))
+			continue;
+		s = &jit_axis[axis];
+
+		s->steps++;
+		if (late >= period)
+			s->misses++;
+		if (late > s->max)
+			s->max = late;
+
+		bucket = &s->hist[trace_bucket(late)];
+		if (*bucket != 0xffff)
+			(*bucket)++;
+	}
+}
+
+void jit_read(uint8_t axis, jit_stats_t *stats)
+{
+	// Short enough to copy with the step interrupt held off.
+	__disable_irq();
+	memcpy(stats, &jit_axis[axis], sizeof(*stats));
+	__enable_irq();
+}
+
+void jit_clear(void)
+{
+	__disable_irq();
+	memset(jit_axis, 0, sizeof(jit_axis));
+	__enable_irq();
+}
@@ -0,0 +1,35 @@
+/* Project: Ewaste 3D Printer
+ * Module: jitter.h
+ * Functionality: Measures how late step edges come against the step timer
+ *
+ * Each tick of the step interrupt is due one period after the one before,
+ * counted from when the timer was started. The step edge of each axis is
+ * compared with that time and the lateness, in cycles at F_CPU, goes into a
+ * histogram laid out like the trace histograms. A tick that comes a whole
+ * period or more late has lost at least one step slot and counts as a
+ * missed deadline. Z is position controlled and makes no step edges.
+ */
+
+#ifndef JITTER_H_
+#define JITTER_H_
+
+#include <stdint.h>
+#include <trace.h>
+
+#define JIT_AXES 		2 		// X and Y make step edges
+
+typedef struct
+{
+	uint32_t steps; 				// Step edges measured
+	uint32_t misses; 				// Edges a period or more late
+	uint32_t max; 					// Latest edge, cycles
+	uint16_t hist[TRACE_BUCKETS]; 	// Saturating bucket counts
+} jit_stats_t;
+
+// Record the edges in the MOTOR_STEP_* mask, late cycles after they were
+// due with a step period of period cycles. Called from the step interrupt.
+void jit_record(uint8_t mask, uint32_t late, uint32_t period);
+void jit_read(uint8_t axis, jit_stats_t *stats); 	// Copy one axis
+void jit_clear(void); 								// Restart every axis
+
+#endif
@@ -3,24 +3,21 @@
  * Functionality: The main execution file
  */
 
-// System includes
-#include <avr/pgmspace.h>
-#include <avr/interrupt.h>
-
-#include <avr_functions.h>
-#include <avr_emulation.h>
-
-#include <IntervalTimer.h>
-
 // Custom includes
+#include <hal.h>
 #include <motor.h>
 #include <usb.h>
 #include <commands.h>
+#include <event.h>
+#include <trace.h>
+#include <segment.h>
+#include <telemetry.h>
 
-int main(void)
+// Split from main() so host builds can drive the loop themselves.
+void setup(void)
 {
-	// Variables
-	uint8_t nbytes;
+	// Start the cycle counter before any timed interrupt can run.
+	trace_init();
 
 	// Initialize USB.
 	usb_init();
@@ -30,24 +27,54 @@ int main(void)
 
 	// Halt till the device configures itself.
 	usb_wait();
+
+#ifdef SEG_ISR
+	// Segment packets go straight to the motion queue.
+	usb_fast(cmd_fast);
+#endif
 	
 	// System is idle.
 	idle();
+}
 
-	while (1)
+void loop(void)
+{
+	// Sleep until an interrupt. SysTick wakes the loop every
+	// millisecond, so the timed work below still runs.
+	ev_wait();
+
+	// Execute every command received since the last event. The final
+	// usb_recv() hands back the last packet.
+	if (ev_take(EV_USB_RX))
 	{
-		// Receive and echo the packet.
-		nbytes = usb_recv();
+		while (usb_recv())
+		{
+			cmd_exec();
 
-		// Do nothing if no bytes are received.
-		if (nbytes == 0)
-			continue;		
+			// If any test mode is on, complete the routine.
+			if ((x_test || y_test || z_test) && !seg_moving())
+				test_exec();
+		}
+	}
 
-		// Execute the command
-		cmd_exec();
+	// Queue held packets as the step interrupt frees slots.
+	seg_release();
 
-		// If any test mode is on, complete the routine.
-		if (x_test || y_test || z_test)
-			test_exec();
-	}
+	// Let the host refill the queue without polling.
+	if (ev_take(EV_LOW_WATER))
+		usb_send_credits();
+
+	// Push telemetry when its timer says it is due.
+	if (ev_take(EV_TELEMETRY))
+		tel_exec();
+}
+
+#ifndef HOST_BUILD
+int main(void)
+{
+	setup();
+
+	while (1)
+		loop();
 }
+#endif
@@ -5,6 +5,7 @@
  */
 
 #include <motor.h>
+#include <trace.h>
 
 // Global variables
 uint8_t x_state = MOTOR_OK;
@@ -26,7 +27,9 @@ volatile int z_pos = 0;
 volatile int z_max = 0;
 volatile int z_pos_cur = 0;
 
-IntervalTimer pos_timer_z;
+uint32_t motor_edge = 0;
+
+sched_timer_t pos_timer_z;
 
 void motor_init(void)
 {
@@ -158,7 +161,7 @@ uint16_t motor_z_calib(void)
 	analogWrite(MOTOR_Z_MNS, 0);
 
 	// Shut down position timer now.
-	pos_timer_z.end();
+	sched_stop(&pos_timer_z);
 
 	// Move towards SW1 and then halt.
 	z_dir = DIR2;
@@ -189,19 +192,19 @@ uint16_t motor_z_calib(void)
 	z_pos = z_max = z_pos_cur;
 
 	// Switch on the position polling timer.
-	pos_timer_z.begin(pos_func, POS_TIMER);
+	sched_start(&pos_timer_z, pos_func, POS_TIMER, POS_TIMER);
 
 	return z_max;
 }
 
-uint8_t get_x_state(void)
+uint8_t FASTRUN get_x_state(void)
 {
-	return 2*digitalRead(MOTOR_X_SW1) + digitalRead(MOTOR_X_SW2);
+	return 2*digitalReadFast(MOTOR_X_SW1) + digitalReadFast(MOTOR_X_SW2);
 }
 
-uint8_t get_y_state(void)
+uint8_t FASTRUN get_y_state(void)
 {
-	return 2*digitalRead(MOTOR_Y_SW1) + digitalRead(MOTOR_Y_SW2);
+	return 2*digitalReadFast(MOTOR_Y_SW1) + digitalReadFast(MOTOR_Y_SW2);
 }
 
 uint8_t get_z_state(void)
@@ -273,6 +276,120 @@ uint8_t motor_z_move(int dir, uint8_t nsteps, uint16_t step_delay)
 	return nsteps;
 }
 
+static inline uint8_t motor_can_move(uint8_t state, int dir)
+{
+	return (state == MOTOR_OK) || (state == MOTOR_SW2_ON && dir == DIR1) ||
+			(state == MOTOR_SW1_ON && dir == DIR2);
+}
+
+// Line being stepped out, one step per motor_line_step()
+static int line_nx, line_ny, line_n, line_ex, line_ey, line_steps;
+static uint8_t line_xdir, line_ydir;
+static uint8_t line_edges; 		// MOTOR_STEP_X and Y, raised on the next tick
+
+void FASTRUN motor_line_begin(int dx, int dy, int dz)
+{
+	// Z is position controlled, so just move the setpoint.
+	z_pos += dz;
+	if (z_pos > z_max)
+		z_pos = z_max;
+	if (z_pos < 0)
+		z_pos = 0;
+
+	// DIR1 increases the position count. The pins follow in
+	// motor_line_lower(), once the edge still owed is out.
+	line_xdir = (dx >= 0) ? DIR1 : DIR2;
+	line_ydir = (dy >= 0) ? DIR1 : DIR2;
+	line_nx = (dx >= 0) ? dx : -dx;
+	line_ny = (dy >= 0) ? dy : -dy;
+	line_n = (line_nx > line_ny) ? line_nx : line_ny;
+
+	// Bresenham interpolation along the longer axis.
+	line_ex = line_ey = line_n / 2;
+	line_steps = 0;
+}
+
+uint8_t FASTRUN motor_line_raise(void)
+{
+	uint8_t edges = line_edges;
+
+	if (edges & MOTOR_STEP_X)
+		digitalWriteFast(MOTOR_X_STP, HIGH);
+	if (edges & MOTOR_STEP_Y)
+		digitalWriteFast(MOTOR_Y_STP, HIGH);
+	if (edges == 0)
+		return 0;
+	motor_edge = trace_clock();
+
+	// No line has begun since these were worked out, so the directions
+	// are still theirs.
+	if (edges & MOTOR_STEP_X)
+		x_pos -= 2*line_xdir - 1;
+	if (edges & MOTOR_STEP_Y)
+		y_pos -= 2*line_ydir - 1;
+
+	line_edges = 0;
+	return edges;
+}
+
+void FASTRUN motor_line_lower(void)
+{
+	digitalWriteFast(MOTOR_X_STP, LOW);
+	digitalWriteFast(MOTOR_Y_STP, LOW);
+
+	// Direction changes with the step pins low, a whole interval ahead of
+	// the edge it is for.
+	digitalWriteFast(MOTOR_X_DIR, line_xdir);
+	digitalWriteFast(MOTOR_Y_DIR, line_ydir);
+}
+
+uint8_t FASTRUN motor_line_step(void)
+{
+	uint8_t xstep = 0, ystep = 0;
+
+	if (line_steps == line_n)
+		return 0;
+	line_steps++;
+
+	line_ex += line_nx;
+	if (line_ex >= line_n)
+	{
+		line_ex -= line_n;
+		xstep = motor_can_move(get_x_state(), line_xdir);
+	}
+
+	line_ey += line_ny;
+	if (line_ey >= line_n)
+	{
+		line_ey -= line_n;
+		ystep = motor_can_move(get_y_state(), line_ydir);
+	}
+
+	line_edges = (xstep ? MOTOR_STEP_X : 0) | (ystep ? MOTOR_STEP_Y : 0);
+
+	return MOTOR_STEP_TICK | line_edges | ((line_steps == line_n) ? MOTOR_STEP_LAST : 0);
+}
+
+void motor_home(void)
+{
+	// Switch 2 is the origin, as after calibration.
+	while (motor_can_move(get_x_state(), DIR2))
+	{
+		_motor_x_move(DIR2);
+		delayMicroseconds(MOTOR_X_CALIB_TIME);
+	}
+
+	while (motor_can_move(get_y_state(), DIR2))
+	{
+		_motor_y_move(DIR2);
+		delayMicroseconds(MOTOR_X_CALIB_TIME);
+	}
+
+	x_pos = 0;
+	y_pos = 0;
+	z_pos = 0;
+}
+
 uint8_t _motor_x_move(int dir)
 {
 	// Write the direction
@@ -330,6 +447,7 @@ void test_exec(void)
 {
 	if (x_test == ENABLE)
 	{
+		x_state = get_x_state();
 		if (x_state == MOTOR_SW1_ON)
 			x_dir = DIR2;
 		if (x_state == MOTOR_SW2_ON)
@@ -340,6 +458,7 @@ void test_exec(void)
 
 	if (y_test == ENABLE)
 	{
+		y_state = get_y_state();
 		if (y_state == MOTOR_SW1_ON)
 			y_dir = DIR2;
 		if (y_state == MOTOR_SW2_ON)
@@ -350,6 +469,7 @@ void test_exec(void)
 
 	if (z_test == ENABLE)
 	{
+		z_state = get_z_state();
 		if (z_state == MOTOR_SW1_ON)
 			z_dir = DIR2;
 		if (z_state == MOTOR_SW2_ON)
@@ -361,8 +481,10 @@ void test_exec(void)
 	delay(MOTOR_X_CALIB_TIME);
 }
 
-void enc_isr(void)
+void FASTRUN enc_isr(void)
 {
+	TRACE_ENTER(TRACE_ENC);
+
 	// Shut down the motor outputs.
 	analogWrite(MOTOR_Z_PLS, 0);
 	analogWrite(MOTOR_Z_MNS, 0);
@@ -371,10 +493,14 @@ void enc_isr(void)
 		z_pos_cur += 1;
 	else if (z_dir == DIR2)
 		z_pos_cur -= 1;
+
+	TRACE_EXIT(TRACE_ENC);
 }
 
 void pos_func(void)
 {
+	TRACE_ENTER(TRACE_POS);
+
 	// Regularly poll for position update.
 	if (z_pos_cur > z_pos)
 	{
@@ -394,4 +520,5 @@ void pos_func(void)
 		analogWrite(MOTOR_Z_MNS, 0);
 	}
 
+	TRACE_EXIT(TRACE_POS);
 }
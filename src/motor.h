@@ -8,8 +8,8 @@
 #define MOTOR_H_
 
 #include <stdint.h>
-#include <avr_emulation.h>
-#include <IntervalTimer.h>
+#include <hal.h>
+#include <schedule.h>
 
 #define LED 				13 		// LED for debugging purposes
 
@@ -47,7 +47,12 @@
 #define MOTOR_Z_CALIB_TIME 	10 		// Z calibration step interval
 #define MOTOR_Z_PWM_VAL 	180 	// Z axis PWM value
 
-#define POS_TIMER 			10000 	// Microseconds between z motor polling
+#define POS_TIMER 			10 		// Scheduler ticks between z motor polling
+
+#define MOTOR_STEP_X 		0x01 	// motor_line_step() owes an X edge
+#define MOTOR_STEP_Y 		0x02 	// motor_line_step() owes a Y edge
+#define MOTOR_STEP_LAST 	0x40 	// motor_line_step() finished the line
+#define MOTOR_STEP_TICK 	0x80 	// motor_line_step() used the tick
 
 #define DIR1 				0 		// Approaching SW1
 #define DIR2 				1 		// Approaching SW2
@@ -77,6 +82,19 @@ uint8_t motor_x_move(int dir, uint8_t nsteps, uint16_t step_delay);
 uint8_t motor_y_move(int dir, uint8_t nsteps, uint16_t step_delay);
 uint8_t motor_z_move(int dir, uint8_t nsteps, uint16_t step_delay);
 
+// Coordinated XY line with a Z setpoint change, stepped from an interrupt.
+// motor_line_step() works out one step and returns MOTOR_STEP_* bits, or
+// zero once the line is done. Each tick of the step interrupt starts with
+// motor_line_raise(), which raises the pins for the step worked out on the
+// tick before and returns their MOTOR_STEP_X and Y bits. It ends with
+// motor_line_lower(). Pulses are high for the interrupt body and low for
+// the rest of the interval, with nothing waiting in between.
+void motor_line_begin(int dx, int dy, int dz);
+uint8_t motor_line_step(void);
+uint8_t motor_line_raise(void);
+void motor_line_lower(void);
+void motor_home(void); 							// Run X and Y to switch 2, Z to the bottom
+
 void test_exec(void);							// Test mode execution
 void enc_isr(void); 							// Encoder ISR
 void pos_func(void); 							// Polling timer for Z position
@@ -87,7 +105,8 @@ extern uint8_t x_test, y_test, z_test; 			// Motor test modes
 extern volatile uint8_t x_dir, y_dir, z_dir;  	// Motor direction
 extern volatile int x_pos, y_pos, z_pos; 		// Motor position
 extern volatile int z_max, z_pos_cur; 			// Z position helper variables
+extern uint32_t motor_edge; 					// trace_clock() at the last step edge
 
 // Z position polling timer
-extern IntervalTimer pos_timer_z;
+extern sched_timer_t pos_timer_z;
 #endif
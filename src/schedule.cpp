@@ -0,0 +1,139 @@
+/* Project: Ewaste 3D Printer
+ * Module: schedule.cpp
+ * Functionality: Runs software timers from a wheel turned by one PIT channel
+ */
+
+#include <hal.h>
+#include <schedule.h>
+
+// Timers per slot, appended at the tail so equal deadlines keep their order
+static sched_timer_t *sched_head[SCHED_SLOTS];
+static sched_timer_t *sched_tail[SCHED_SLOTS];
+
+static IntervalTimer sched_timer;
+static volatile uint32_t sched_now = 0; 	// Ticks so far
+static uint64_t sched_next = 0; 			// hal_clock() the next tick is due
+static uint8_t sched_armed = 0; 			// Timers in the wheel
+
+static void sched_link(sched_timer_t *t)
+{
+	uint8_t slot = t->due & SCHED_MASK;
+
+	t->next = NULL;
+	if (sched_head[slot])
+		sched_tail[slot]->next = t;
+	else
+		sched_head[slot] = t;
+	sched_tail[slot] = t;
+}
+
+static void sched_unlink(sched_timer_t *t, sched_timer_t *prev)
+{
+	uint8_t slot = t->due & SCHED_MASK;
+
+	if (prev)
+		prev->next = t->next;
+	else
+		sched_head[slot] = t->next;
+	if (sched_tail[slot] == t)
+		sched_tail[slot] = prev;
+}
+
+static void sched_remove(sched_timer_t *t)
+{
+	sched_timer_t *p, *prev = NULL;
+
+	for (p = sched_head[t->due & SCHED_MASK]; p != t; p = p->next)
+		prev = p;
+	sched_unlink(t, prev);
+}
+
+static void sched_run(void)
+{
+	sched_timer_t *t, *prev;
+	uint8_t slot = sched_now & SCHED_MASK;
+
+	// Look again from the head after every callback, as it may start or
+	// stop timers in this slot.
+	while (1)
+	{
+		prev = NULL;
+		for (t = sched_head[slot]; t && t->due != sched_now; t = t->next)
+			prev = t;
+		if (t == NULL)
+			break;
+
+		// Requeued before the callback runs, so it can stop itself.
+		sched_unlink(t, prev);
+		if (t->period)
+		{
+			t->due += t->period;
+			sched_link(t);
+		}
+		else
+		{
+			t->armed = 0;
+			if (--sched_armed == 0)
+				sched_timer.end();
+		}
+
+		t->fn();
+	}
+}
+
+static void sched_tick(void)
+{
+	// Ticks are counted on the clock. A PIT channel keeps one tick pending,
+	// so a tick held off past the next one would otherwise be lost.
+	while (sched_armed && hal_clock() >= sched_next)
+	{
+		sched_next += SCHED_TICK*(F_CPU/1000000);
+		sched_now++;
+		sched_run();
+	}
+}
+
+void sched_start(sched_timer_t *t, void (*fn)(void), uint32_t delay, uint32_t period)
+{
+	// Callbacks start timers too, so restore rather than enable interrupts.
+	uint32_t primask = hal_irq_save();
+
+	if (t->armed)
+		sched_remove(t);
+	else if (sched_armed++ == 0)
+	{
+		// Read first, so the timer never fires ahead of the clock.
+		sched_next = hal_clock() + SCHED_TICK*(F_CPU/1000000);
+		sched_timer.begin(sched_tick, SCHED_TICK);
+	}
+
+	t->fn = fn;
+	t->period = period;
+	t->due = sched_now + (delay ? delay : 1);
+	t->armed = 1;
+	sched_link(t);
+
+	hal_irq_restore(primask);
+}
+
+void sched_stop(sched_timer_t *t)
+{
+	uint32_t primask = hal_irq_save();
+
+	if (t->armed)
+	{
+		sched_remove(t);
+		t->armed = 0;
+
+		// No wakeups while nothing is pending.
+		if (--sched_armed == 0)
+			sched_timer.end();
+	}
+
+	hal_irq_restore(primask);
+}
+
+uint32_t sched_ticks(void)
+{
+	return sched_now;
+}
@@ -0,0 +1,51 @@
+/* Project: Ewaste 3D Printer
+ * Module: schedule.h
+ * Functionality: Defines software timers sharing one PIT channel, so the
+ *                other channel is left to the step interrupt
+ *
+ * The LC has two PIT channels. One ticks every SCHED_TICK microseconds
+ * while any timer is running and turns a wheel of SCHED_SLOTS slots. Each
+ * timer is linked into the slot its deadline falls in, so starting one
+ * takes the same time however many are pending. Every tick then looks
+ * through a single slot and runs the timers that are due on that tick.
+ * Timers further out than one turn of the wheel wait in their slot for a
+ * later pass.
+ *
+ * Timers therefore run in deadline order. Timers due on the same tick run
+ * in the order they were started. A periodic timer is due again whole
+ * periods after its first deadline, so it does not drift when its callback
+ * runs late.
+ *
+ * Ticks are counted against hal_clock(), so a tick interrupt held off past
+ * the next one still runs both.
+ *
+ * Callbacks run in the tick interrupt. On the LC both PIT channels share
+ * one interrupt, so a callback also holds off step ticks and must stay
+ * short. Longer work should post an event to the main loop.
+ */
+
+#ifndef SCHEDULE_H_
+#define SCHEDULE_H_
+
+#include <stdint.h>
+
+#define SCHED_TICK 		1000 	// Microseconds per tick
+#define SCHED_SLOTS 	16 		// Wheel slots, power of two
+#define SCHED_MASK 		(SCHED_SLOTS - 1)
+
+typedef struct sched_timer
+{
+	struct sched_timer *next; 	// Next timer in the same slot
+	void (*fn)(void); 			// Callback, run from the tick interrupt
+	uint32_t due; 				// Tick the callback runs on
+	uint32_t period; 			// Ticks between runs, zero runs once
+	uint8_t armed; 				// Linked into the wheel
+} sched_timer_t;
+
+// Run fn after delay ticks, then every period ticks unless that is zero.
+// Starting a running timer restarts it. Safe from callbacks.
+void sched_start(sched_timer_t *t, void (*fn)(void), uint32_t delay, uint32_t period);
+void sched_stop(sched_timer_t *t); 		// Stop a timer, safe from callbacks
+uint32_t sched_ticks(void); 			// Ticks since the wheel first turned
+
+#endif
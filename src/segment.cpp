@@ -0,0 +1,408 @@
+/* Project: Ewaste 3D Printer
+ * Module: segment.cpp
+ * Functionality: Decodes compact motion segments and runs the motion queue
+ */
+
+#include <motor.h>
+#include <usb.h>
+#include <event.h>
+#include <trace.h>
+#include <jitter.h>
+#include <segment.h>
+
+// Motion queue. Indices run freely and are masked on access.
+static segment_t seg_queue[SEG_QUEUE_SIZE];
+static volatile uint8_t seg_head = 0; 		// Next slot to fill
+static volatile uint8_t seg_tail = 0; 		// Next slot to execute
+
+static_assert(SEG_PACKET_SIZE == BUF_SIZE, "segment packets fill a USB packet");
+
+// Packets that arrived ahead of the queue, still in their USB buffers
+static uint8_t *seg_held[SEG_WINDOW];
+
+// Step interrupt running the queue. The timer takes a new period at its
+// next reload, so the one counting down can be behind the one last set.
+static IntervalTimer seg_timer;
+static volatile uint8_t seg_running = 0;
+static uint16_t seg_period = 0; 	// Counting down to the next tick
+static uint16_t seg_reload = 0; 	// Taken at the next tick
+static uint32_t seg_due = 0; 		// trace_clock() the next tick is due
+
+// Non-zero while the main loop is changing the sequence or held packets,
+// seg_accept_isr() leaves packets alone until it is done.
+static volatile uint8_t seg_lock = 0;
+
+uint16_t seg_feed = SEG_FEED_DEFAULT;
+uint8_t seg_seq = 0xff;
+
+uint8_t FASTRUN seg_count(void)
+{
+	return (uint8_t)(seg_head - seg_tail);
+}
+
+uint8_t seg_free(void)
+{
+	return SEG_QUEUE_SIZE - seg_count();
+}
+
+uint8_t seg_push(const segment_t *seg)
+{
+	if (seg_free() == 0)
+		return 0;
+
+	// The slot is filled before it is published to the consumer.
+	seg_queue[seg_head & SEG_QUEUE_MASK] = *seg;
+	__asm__ volatile("" ::: "memory");
+	seg_head++;
+
+	if (!seg_running)
+		seg_start();
+
+	return 1;
+}
+
+uint8_t FASTRUN seg_pop(segment_t *seg)
+{
+	if (seg_count() == 0)
+		return 0;
+
+	*seg = seg_queue[seg_tail & SEG_QUEUE_MASK];
+	__asm__ volatile("" ::: "memory");
+	seg_tail++;
+
+	return 1;
+}
+
+static uint16_t seg_clamp(uint16_t step_delay)
+{
+	return (step_delay < SEG_PERIOD_MIN) ? SEG_PERIOD_MIN : step_delay;
+}
+
+static void seg_step_isr(void);
+
+static void seg_begin(uint16_t period)
+{
+	// Ticks are due whole periods after the timer starts.
+	seg_period = seg_reload = period;
+	seg_timer.begin(seg_step_isr, period);
+	seg_due = trace_clock() + period*(F_CPU/1000000);
+}
+
+// Change the step interval without stopping the timer, from the tick
+// after the next one.
+static inline void seg_update(uint16_t period)
+{
+	if (period != seg_reload)
+	{
+		seg_reload = period;
+		seg_timer.update(period);
+	}
+}
+
+// Cycles the last step edge came after due.
+static inline uint32_t seg_late(uint32_t due)
+{
+	uint32_t late = motor_edge - due;
+
+	return ((int32_t)late < 0) ? 0 : late;
+}
+
+// One step per tick. A segment is loaded as the one before finishes, and
+// its step interval is set on the last tick of that one, so the timer
+// reloads with it just as the segment begins.
+static void FASTRUN seg_step(void)
+{
+	segment_t seg, *next;
+	uint32_t due, late, period;
+	uint8_t mask, edges, loaded = 0, i;
+
+	// The step worked out on the last tick goes out first, so its pins
+	// were low for nearly the whole interval.
+	edges = motor_line_raise();
+
+	// This tick reloaded the timer.
+	seg_period = seg_reload;
+	due = seg_due;
+	period = seg_period*(F_CPU/1000000);
+	seg_due += period;
+
+	// Lines without X or Y steps finish at once, so look on to the next.
+	while (!(mask = motor_line_step()))
+	{
+		if (!seg_pop(&seg))
+		{
+			// The last step has gone out, nothing is owed.
+			motor_line_lower();
+			seg_timer.end();
+			seg_running = 0;
+			jit_record(edges, seg_late(due), period);
+			return;
+		}
+
+		// Tell the host there is room again.
+		if (seg_count() == SEG_LOW_WATER)
+			ev_post(EV_LOW_WATER);
+
+		motor_line_begin(seg.dx, seg.dy, seg.dz);
+		loaded = 1;
+	}
+
+	// Normally set already by the look ahead below. A segment queued too
+	// late for it keeps the old period for its first interval.
+	if (loaded)
+		seg_update(seg_clamp(seg.step_delay));
+
+	// Look ahead on the last tick of a line, past lines that take no tick.
+	// Only the consumer frees slots, so they can be read without taking.
+	if (mask & MOTOR_STEP_LAST)
+	{
+		for (i = seg_tail; i != seg_head; i++)
+		{
+			next = &seg_queue[i & SEG_QUEUE_MASK];
+			if (next->dx || next->dy)
+			{
+				seg_update(seg_clamp(next->step_delay));
+				break;
+			}
+		}
+	}
+
+	motor_line_lower();
+
+	// A tick a whole period late has lost step slots, the timer has not.
+	late = seg_late(due);
+	if (late >= period)
+		seg_due += late/period*period;
+	jit_record(edges, late, period);
+}
+
+static void FASTRUN seg_step_isr(void)
+{
+	TRACE_ENTER(TRACE_STEP);
+	seg_step();
+	TRACE_EXIT(TRACE_STEP);
+}
+
+void seg_start(void)
+{
+	__disable_irq();
+	if (!seg_running && seg_count())
+	{
+		// The first tick loads the oldest segment.
+		seg_running = 1;
+		seg_begin(seg_clamp(seg_queue[seg_tail & SEG_QUEUE_MASK].step_delay));
+	}
+	__enable_irq();
+}
+
+uint8_t seg_moving(void)
+{
+	return seg_running;
+}
+
+void seg_drain(void)
+{
+	while (seg_running)
+		ev_sleep();
+}
+
+// Read an unsigned varint without running past the end of the packet.
+static uint32_t seg_varint(const uint8_t **p, const uint8_t *end)
+{
+	uint32_t val = 0;
+	uint8_t shift = 0;
+	uint8_t b;
+
+	while (*p < end && shift < SEG_VARINT_BITS)
+	{
+		b = *(*p)++;
+		val |= (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+
+		if ((b & 0x80) == 0)
+			break;
+	}
+
+	return val;
+}
+
+// Undo zig-zag mapping and scale by the repeat count.
+static int32_t seg_delta(uint32_t val, uint8_t reps)
+{
+	return ((int32_t)(val >> 1) ^ -(int32_t)(val & 1)) * reps;
+}
+
+// Check that every delta times its repeat count fits a segment_t.
+static uint8_t seg_range(const uint8_t *buf)
+{
+	const uint8_t *p = buf + SEG_HDR_SIZE;
+	const uint8_t *end = buf + SEG_CRC;
+	uint8_t nseg = buf[SEG_HDR_COUNT];
+	uint8_t flags, reps, axis, n;
+	int32_t delta;
+
+	for (n = 0; n < nseg && p < end; n++)
+	{
+		flags = *p++;
+		reps = (flags >> SEG_REPEAT_SHIFT) + 1;
+
+		for (axis = SEG_FLAG_X; axis <= SEG_FLAG_Z; axis <<= 1)
+		{
+			if (!(flags & axis))
+				continue;
+			delta = seg_delta(seg_varint(&p, end), reps);
+			if (delta > SEG_DELTA_MAX || delta < -SEG_DELTA_MAX)
+				return 0;
+		}
+
+		if (flags & SEG_FLAG_F)
+			seg_varint(&p, end);
+	}
+
+	return 1;
+}
+
+uint8_t seg_decode(const uint8_t *buf, uint8_t len)
+{
+	const uint8_t *p = buf + SEG_HDR_SIZE;
+	const uint8_t *end = buf + len;
+	uint8_t nseg, flags, reps, n;
+	segment_t seg;
+
+	if (len <= SEG_HDR_SIZE)
+		return 0;
+
+	nseg = buf[SEG_HDR_COUNT];
+
+	for (n = 0; n < nseg && p < end; n++)
+	{
+		flags = *p++;
+
+		// A repeated segment is the same line scaled, so it takes one slot.
+		reps = (flags >> SEG_REPEAT_SHIFT) + 1;
+
+		// Absent fields read as zero, or as the previous feed.
+		seg.dx = (flags & SEG_FLAG_X) ? (int16_t)seg_delta(seg_varint(&p, end), reps) : 0;
+		seg.dy = (flags & SEG_FLAG_Y) ? (int16_t)seg_delta(seg_varint(&p, end), reps) : 0;
+		seg.dz = (flags & SEG_FLAG_Z) ? (int16_t)seg_delta(seg_varint(&p, end), reps) : 0;
+
+		if (flags & SEG_FLAG_F)
+			seg_feed = (uint16_t)seg_varint(&p, end);
+		seg.step_delay = seg_feed;
+
+		if (!seg_push(&seg))
+			break;
+	}
+
+	return n;
+}
+
+static uint8_t seg_check(const uint8_t *buf)
+{
+	uint16_t crc = buf[SEG_CRC] | (buf[SEG_CRC + 1] << 8);
+
+	return crc16(buf, SEG_CRC) == crc;
+}
+
+void seg_release(void)
+{
+	uint8_t next, *buf;
+
+	seg_lock++;
+
+	// Queue held packets in order while there is room for them.
+	while (1)
+	{
+		next = seg_seq + 1;
+		buf = seg_held[next & (SEG_WINDOW - 1)];
+		if (buf == NULL || buf[SEG_HDR_COUNT] > seg_free())
+			break;
+
+		seg_held[next & (SEG_WINDOW - 1)] = NULL;
+		seg_decode(buf, SEG_CRC);
+		usb_release(buf);
+		seg_seq = next;
+	}
+
+	seg_lock--;
+}
+
+static uint8_t seg_admit(uint8_t *buf)
+{
+	uint8_t seq = buf[SEG_HDR_SEQ];
+	uint8_t nseg = buf[SEG_HDR_COUNT];
+	uint8_t ahead, i;
+
+	if (!seg_check(buf))
+		return SEG_BAD_CRC;
+	if (!seg_range(buf))
+		return SEG_RANGE;
+
+	// An empty packet restarts the sequence.
+	if (nseg == 0)
+	{
+		for (i = 0; i < SEG_WINDOW; i++)
+		{
+			if (seg_held[i])
+				usb_release(seg_held[i]);
+			seg_held[i] = NULL;
+		}
+		seg_seq = seq;
+		return SEG_OK;
+	}
+
+	// A retransmit of a packet that was already queued.
+	ahead = seq - seg_seq;
+	if (ahead == 0 || ahead > 0x80)
+		return SEG_OK;
+
+	// A packet that could never fit would block the window.
+	if (ahead > SEG_WINDOW || nseg > SEG_QUEUE_SIZE)
+		return SEG_ORDER;
+
+	// Take the packet over from the USB code, no copy is made.
+	if (seg_held[seq & (SEG_WINDOW - 1)] == NULL)
+		seg_held[seq & (SEG_WINDOW - 1)] = usb_keep();
+	seg_release();
+
+	if ((uint8_t)(seq - seg_seq) > 0x80 || seq == seg_seq)
+		return SEG_OK;
+	if (seg_held[(uint8_t)(seg_seq + 1) & (SEG_WINDOW - 1)] == NULL)
+		return SEG_GAP;
+
+	return SEG_HELD;
+}
+
+uint8_t seg_accept(uint8_t *buf)
+{
+	uint8_t status;
+
+	seg_lock++;
+	status = seg_admit(buf);
+	seg_lock--;
+
+	return status;
+}
+
+uint8_t seg_accept_isr(const uint8_t *buf)
+{
+	uint8_t i;
+
+	// Only the next packet, when it fits now, is taken. Everything else,
+	// including a bad CRC, is answered by seg_accept() from the main loop.
+	if (seg_lock || buf[SEG_HDR_SEQ] != (uint8_t)(seg_seq + 1) ||
+			buf[SEG_HDR_COUNT] == 0 || buf[SEG_HDR_COUNT] > seg_free())
+		return 0;
+
+	for (i = 0; i < SEG_WINDOW; i++)
+		if (seg_held[i])
+			return 0;
+
+	if (!seg_check(buf) || !seg_range(buf))
+		return 0;
+
+	seg_decode(buf, SEG_CRC);
+	seg_seq = buf[SEG_HDR_SEQ];
+
+	return 1;
+}
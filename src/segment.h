@@ -0,0 +1,102 @@
+/* Project: Ewaste 3D Printer
+ * Module: segment.h
+ * Functionality: Defines the compact motion segment encoding and the motion
+ *                queue it feeds
+ *
+ * Packet layout (after the command byte):
+ *  [1] 		Sequence number, one more than the previous packet
+ *  [2] 		Number of encoded segments in the packet
+ *  [3..] 		Segments, each one being
+ * 		flags 		SEG_FLAG_* bits, repeat count in the high nibble
+ * 		dx, dy, dz 	Zig-zag varint deltas, present only if flagged
+ * 		feed 		Varint step interval in microseconds, present only if
+ * 					flagged. Otherwise the previous feed is reused.
+ *
+ *  [62..63] 	CRC-16 of bytes 0 to 61, little endian
+ *
+ * Every segment takes one queue slot. A packet is queued whole or not at all,
+ * and one with a delta times repeat count beyond SEG_DELTA_MAX is refused
+ * with SEG_RANGE rather than clamped, as resending it cannot help.
+ * Packets up to SEG_WINDOW ahead of the last queued one are held in their
+ * USB buffers until the packets before them and enough queue slots arrive,
+ * so one bad or lost packet only costs its own retransmit. Each packet is
+ * answered with a SEG_* status, its sequence number and, for SEG_GAP, the
+ * missing sequence number. Every reply also carries the last queued sequence
+ * number and the free slots (credits), so the host can keep the queue full
+ * without overrunning it. A packet with no segments resynchronises the
+ * sequence number and drops any held packets.
+ *
+ * Segments are stepped out by a timer interrupt, one step per tick, so the
+ * main loop can sleep. When the queue drains to SEG_LOW_WATER the host is
+ * sent a USB_RPT_CREDITS report, so it need not poll while waiting for room.
+ */
+
+#ifndef SEGMENT_H_
+#define SEGMENT_H_
+
+#include <stdint.h>
+#include <crc.h>
+
+#define SEG_QUEUE_SIZE 		64 		// Motion queue slots, power of two
+#define SEG_QUEUE_MASK 		(SEG_QUEUE_SIZE - 1)
+
+#define SEG_HDR_SEQ 		1 		// Offset of the sequence number
+#define SEG_HDR_COUNT 		2 		// Offset of the segment count
+#define SEG_HDR_SIZE 		3 		// Offset of the first segment
+#define SEG_PACKET_SIZE 	64 		// Whole packet, CRC included
+#define SEG_CRC 			(SEG_PACKET_SIZE - CRC_SIZE) 	// Offset of the CRC
+#define SEG_WINDOW 			4 		// Packets held ahead, power of two
+
+#define SEG_RPL_STATUS 		0 		// Reply offset of the SEG_* status
+#define SEG_RPL_SEQ 		1 		// Reply offset of the sequence number
+#define SEG_RPL_MISSING 	2 		// Reply offset of the missing sequence
+
+#define SEG_OK 				0 		// Packet queued, or queued before
+#define SEG_HELD 			1 		// Held for earlier packets or credits
+#define SEG_ORDER 			2 		// Outside the window, dropped
+#define SEG_BAD_CRC 		3 		// CRC mismatch, dropped
+#define SEG_GAP 			4 		// Held, an earlier packet never arrived
+#define SEG_RANGE 			5 		// A delta overflows SEG_DELTA_MAX, dropped
+
+#define SEG_FLAG_X 			0x01 	// X delta present
+#define SEG_FLAG_Y 			0x02 	// Y delta present
+#define SEG_FLAG_Z 			0x04 	// Z delta present
+#define SEG_FLAG_F 			0x08 	// Feed present
+#define SEG_REPEAT_SHIFT 	4 		// Extra repetitions in the high nibble
+
+#define SEG_VARINT_BITS 	21 		// Longest varint is three bytes
+#define SEG_DELTA_MAX 		32767 	// Largest delta after repetition
+#define SEG_FEED_DEFAULT 	600 	// Step interval until the host sets one
+#define SEG_PERIOD_MIN 		50 		// Shortest step interval the interrupt runs
+#define SEG_LOW_WATER 		(SEG_QUEUE_SIZE / 4) 	// Depth that sends credits
+
+typedef struct
+{
+	int16_t dx, dy, dz; 		// Steps to move along each axis
+	uint16_t step_delay; 		// Microseconds between steps
+} segment_t;
+
+uint8_t seg_count(void); 					// Queued segments
+uint8_t seg_free(void); 					// Free queue slots
+uint8_t seg_push(const segment_t *seg); 	// Add a segment to the queue
+uint8_t seg_pop(segment_t *seg); 			// Take the oldest segment
+void seg_start(void); 						// Start the step interrupt if idle
+uint8_t seg_moving(void); 					// Step interrupt is running
+void seg_drain(void); 						// Sleep until the queue has run out
+
+// Decode a packet of compact segments into the queue
+uint8_t seg_decode(const uint8_t *buf, uint8_t len);
+
+// Check the CRC and sequence, then queue or hold the packet in usb_in_buffer.
+// Returns a SEG_* status.
+uint8_t seg_accept(uint8_t *buf);
+void seg_release(void); 					// Queue held packets that fit
+
+// Queue the next packet in sequence from the USB interrupt if that can be
+// done right away. Returns zero to leave it to seg_accept().
+uint8_t seg_accept_isr(const uint8_t *buf);
+
+extern uint16_t seg_feed; 					// Current step interval
+extern uint8_t seg_seq; 					// Last accepted sequence number
+
+#endif
@@ -0,0 +1,80 @@
+/* Project: Ewaste 3D Printer
+ * Module: telemetry.cpp
+ * Functionality: Pushes periodic telemetry reports to the host
+ */
+
+#include <motor.h>
+#include <usb.h>
+#include <event.h>
+#include <segment.h>
+#include <telemetry.h>
+
+static sched_timer_t tel_timer;
+static uint16_t tel_period = 0;
+
+static void tel_put16(uint8_t *buf, uint8_t offset, int val)
+{
+	buf[offset] = (uint8_t)(val & 0xff);
+	buf[offset + 1] = (uint8_t)((val >> 8) & 0xff);
+}
+
+static void tel_fill(uint8_t *buf, uint32_t now)
+{
+	tel_put16(buf, TEL_X_POS, x_pos);
+	tel_put16(buf, TEL_Y_POS, y_pos);
+	tel_put16(buf, TEL_Z_SET, z_pos);
+	tel_put16(buf, TEL_Z_ERR, z_pos - z_pos_cur);
+
+	buf[TEL_X_STATE] = get_x_state();
+	buf[TEL_Y_STATE] = get_y_state();
+	buf[TEL_Z_STATE] = get_z_state();
+	buf[TEL_QUEUE] = seg_count();
+
+	tel_put16(buf, TEL_TIME, now & 0xffff);
+	tel_put16(buf, TEL_TIME + 2, now >> 16);
+}
+
+static void tel_due(void)
+{
+	ev_post(EV_TELEMETRY);
+}
+
+void tel_start(uint16_t period)
+{
+	tel_period = period;
+	if (period)
+		sched_start(&tel_timer, tel_due, period*1000/SCHED_TICK, period*1000/SCHED_TICK);
+	else
+		sched_stop(&tel_timer);
+}
+
+void tel_exec(void)
+{
+	uint32_t now = millis();
+
+	// A report may have been due just before they were stopped.
+	if (tel_period == 0)
+		return;
+
+#ifdef USB_STREAM
+	// Keep the command endpoint free, send on the stream port instead.
+	uint8_t buf[TEL_SIZE];
+
+	tel_fill(buf, now);
+	usb_stream(USB_RPT_TELEMETRY, buf, TEL_SIZE);
+#else
+	uint8_t *buf;
+
+	// A host that is not reading should not stall the machine.
+	if (usb_tx_packet_count(USB_TX_ENDPOINT) >= TEL_TX_LIMIT)
+		return;
+
+	// The report is built in place in its tx packet.
+	buf = usb_alloc(0);
+	if (buf == NULL)
+		return;
+
+	tel_fill(buf, now);
+	usb_send_report(buf, USB_RPT_TELEMETRY);
+#endif
+}
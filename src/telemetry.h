@@ -0,0 +1,28 @@
+/* Project: Ewaste 3D Printer
+ * Module: telemetry.h
+ * Functionality: Defines the periodic telemetry report pushed to the host
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+// Report layout, all multi-byte fields little endian
+#define TEL_X_POS 		0 		// X position, 2 bytes
+#define TEL_Y_POS 		2 		// Y position, 2 bytes
+#define TEL_Z_SET 		4 		// Z setpoint, 2 bytes
+#define TEL_Z_ERR 		6 		// Z setpoint minus encoder count, 2 bytes
+#define TEL_X_STATE 	8 		// X switch state
+#define TEL_Y_STATE 	9 		// Y switch state
+#define TEL_Z_STATE 	10 		// Z switch state
+#define TEL_QUEUE 		11 		// Motion queue depth
+#define TEL_TIME 		12 		// millis() when sampled, 4 bytes
+#define TEL_SIZE 		16 		// Bytes in a report
+
+#define TEL_TX_LIMIT 	2 		// Skip a report if this many are unsent
+
+void tel_start(uint16_t period); 	// Report every period milliseconds, 0 stops
+void tel_exec(void); 				// Send the report that is due
+
+#endif
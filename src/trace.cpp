@@ -0,0 +1,124 @@
+/* Project: Ewaste 3D Printer
+ * Module: trace.cpp
+ * Functionality: Times interrupt handlers into per-handler trace rings and
+ *                statistics
+ */
+
+#include <string.h>
+#include <hal.h>
+#include <trace.h>
+
+void trace_init(void)
+{
+#if defined(KINETISK)
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+#ifdef TRACE
+	trace_clear();
+#endif
+}
+
+uint32_t FASTRUN trace_clock(void)
+{
+#if defined(KINETISK) || defined(HOST_BUILD)
+	return hal_cycles();
+#else
+	// The low half of the SysTick clock, which never masks interrupts
+	// and so adds nothing to the latency of the handlers it times. Only
+	// 32 bits are worked out, so the step edge it stamps stays in RAM.
+	return cycles32();
+#endif
+}
+
+uint8_t FASTRUN trace_bucket(uint32_t cycles)
+{
+	uint8_t n = 0;
+
+	cycles >>= TRACE_HIST_SHIFT + 1;
+	while (cycles && n < TRACE_BUCKETS - 1)
+	{
+		cycles >>= 1;
+		n++;
+	}
+
+	return n;
+}
+
+#ifdef TRACE
+typedef struct
+{
+	volatile uint32_t gen; 		// Odd while a record is being made
+	volatile uint32_t head; 	// Records made, the ring index runs freely
+	trace_rec_t ring[TRACE_RING];
+	trace_stats_t stats;
+} trace_src_t;
+
+static trace_src_t trace_src[TRACE_SOURCES];
+
+void FASTRUN trace_record(uint8_t src, uint32_t begin)
+{
+	trace_src_t *t = &trace_src[src];
+	trace_stats_t *s = &t->stats;
+	uint32_t cycles = trace_clock() - begin;
+	trace_rec_t *rec = &t->ring[t->head & (TRACE_RING - 1)];
+	uint16_t *bucket;
+
+	t->gen++;
+	__asm__ volatile("" ::: "memory");
+
+	rec->begin = begin;
+	rec->cycles = cycles;
+	t->head++;
+
+	if (s->count == 0 || cycles < s->min)
+		s->min = cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	s->total += cycles;
+	s->count++;
+
+	bucket = &s->hist[trace_bucket(cycles)];
+	if (*bucket != 0xffff)
+		(*bucket)++;
+
+	__asm__ volatile("" ::: "memory");
+	t->gen++;
+}
+
+uint8_t trace_read(uint8_t src, trace_stats_t *stats, trace_rec_t *recs,
+		uint8_t max)
+{
+	trace_src_t *t = &trace_src[src];
+	uint32_t gen, head;
+	uint8_t n, i;
+
+	if (max > TRACE_RING)
+		max = TRACE_RING;
+
+	// A handler that runs meanwhile makes the copy start over.
+	do
+	{
+		gen = t->gen;
+		__asm__ volatile("" ::: "memory");
+
+		head = t->head;
+		n = (head < max) ? head : max;
+		memcpy(stats, &t->stats, sizeof(*stats));
+		for (i = 0; i < n; i++)
+			recs[i] = t->ring[(head - n + i) & (TRACE_RING - 1)];
+
+		__asm__ volatile("" ::: "memory");
+	} while ((gen & 1) || gen != t->gen);
+
+	return n;
+}
+
+void trace_clear(void)
+{
+	__disable_irq();
+	memset(trace_src, 0, sizeof(trace_src));
+	__enable_irq();
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* Project: Ewaste 3D Printer
+ * Module: trace.h
+ * Functionality: Times interrupt handlers into per-handler trace rings and
+ *                statistics
+ *
+ * Built with -DTRACE, each traced handler records its entry time and length
+ * in cycles at F_CPU. Every handler has a ring and statistics of its own.
+ * Handlers do not interrupt themselves, so each ring has a single writer and
+ * needs no locking. The main loop reads a handler's statistics between two
+ * reads of its generation count, and tries again if a record happened in
+ * between.
+ *
+ * Cycles come from DWT CYCCNT on Teensy 3.x. The LC has no cycle counter,
+ * so they are built from SysTick and the millisecond count there. The clock
+ * and histogram buckets are built without -DTRACE too, for other timing.
+ *
+ * Histogram bucket n counts records of 2^(n + TRACE_HIST_SHIFT) cycles up
+ * to twice that. The first bucket also holds shorter records and the last
+ * one longer records.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_STEP 			0 		// Step interrupt running the motion queue
+#define TRACE_ENC 			1 		// Z encoder edge, enc_isr()
+#define TRACE_POS 			2 		// Z position polling, pos_func()
+#define TRACE_USB 			3 		// usb_isr()
+#define TRACE_SOURCES 		4
+
+#define TRACE_RING 			16 		// Records kept per handler, power of two
+#define TRACE_BUCKETS 		16 		// Histogram buckets
+#define TRACE_HIST_SHIFT 	4 		// First bucket starts at 16 cycles
+
+typedef struct
+{
+	uint32_t begin; 			// Cycle count at entry
+	uint32_t cycles; 			// Cycles until exit
+} trace_rec_t;
+
+typedef struct
+{
+	uint32_t count; 			// Records since the last clear
+	uint32_t min, max; 			// Shortest and longest, cycles
+	uint64_t total; 			// Sum for the average, cycles
+	uint16_t hist[TRACE_BUCKETS]; 	// Saturating bucket counts
+} trace_stats_t;
+
+#ifdef TRACE
+#define TRACE_ENTER(src) 	uint32_t trace_begin_ = trace_clock()
+#define TRACE_EXIT(src) 	trace_record(src, trace_begin_)
+#else
+#define TRACE_ENTER(src)
+#define TRACE_EXIT(src)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void trace_init(void); 								// Start the cycle counter
+uint32_t trace_clock(void); 						// Cycles at F_CPU
+uint8_t trace_bucket(uint32_t cycles); 				// Histogram bucket
+void trace_record(uint8_t src, uint32_t begin); 	// Record a handler exit
+
+// Copy a handler's statistics, and up to max of its latest records, oldest
+// first. Returns the number of records copied.
+uint8_t trace_read(uint8_t src, trace_stats_t *stats, trace_rec_t *recs,
+		uint8_t max);
+void trace_clear(void); 							// Restart every handler
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
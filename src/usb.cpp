@@ -3,25 +3,214 @@
  * Functionality: Defines USB constants, variables and functions
  */
 
+#include <stddef.h>
+#include <string.h>
 #include <usb.h>
-#include <avr_emulation.h>
+#include <event.h>
+#include <segment.h>
 
-// Buffers
-uint8_t usb_in_buffer[BUF_SIZE];
-uint8_t usb_out_buffer[BUF_SIZE];
+#if defined(USB_VENDOR)
+#define usb_link_rx_packet 		usb_vendor_rx_packet
+#define usb_link_tx_packet 		usb_vendor_tx_packet
+#define usb_link_tx_commit 		usb_vendor_tx_commit
+#define usb_link_available 		usb_vendor_available
+#else
+#define usb_link_rx_packet 		usb_rawhid_rx_packet
+#define usb_link_tx_packet 		usb_rawhid_tx_packet
+#define usb_link_tx_commit 		usb_rawhid_tx_commit
+#define usb_link_available 		usb_rawhid_available
+#endif
+
+// Buffers point into the packets themselves, so nothing is copied.
+uint8_t *usb_in_buffer = NULL;
+uint8_t *usb_out_buffer = NULL;
+uint32_t usb_rx_time = 0;
+volatile usb_fast_stats_t usb_fast_stats;
+
+// Packet owning the input buffer, until usb_recv() or usb_keep()
+static usb_packet_t *usb_rx_packet = NULL;
+
+// Set while usb_recv() takes a packet and until its next call, while the
+// main loop may still owe the reply. The interrupt answers nothing before then,
+// so replies leave in the order commands came in.
+static volatile uint8_t usb_rx_busy = 0;
+static usb_fast_t usb_fast_handler = NULL;
+
+// Recover the packet from a pointer to its data.
+static usb_packet_t *usb_packet(uint8_t *buf)
+{
+	return (usb_packet_t *)(buf - offsetof(usb_packet_t, buf));
+}
 
 uint8_t usb_recv(void)
 {
-	return usb_rawhid_recv(usb_in_buffer, TIMEOUT_RECV);
+	// The previous command is done with, hand its packet back.
+	if (usb_rx_packet)
+		usb_free(usb_rx_packet);
+
+	// Set before the dequeue, which enables interrupts on its way out. A
+	// packet arriving then finds rx_first empty and must still wait.
+	usb_rx_busy = 1;
+	usb_rx_packet = usb_link_rx_packet();
+	if (usb_rx_packet == NULL)
+	{
+		usb_rx_busy = 0;
+		return 0;
+	}
+
+	usb_rx_time = micros();
+	usb_in_buffer = usb_rx_packet->buf;
+	return BUF_SIZE;
+}
+
+uint8_t *usb_keep(void)
+{
+	// usb_recv() will no longer free it, usb_in_buffer stays valid. The
+	// reply is still to come, so usb_rx_busy stays set.
+	usb_rx_packet = NULL;
+
+	return usb_in_buffer;
+}
+
+void usb_release(uint8_t *buf)
+{
+	usb_free(usb_packet(buf));
+}
+
+uint8_t usb_reply(void)
+{
+	usb_out_buffer = usb_alloc(TIMEOUT_SEND);
+	if (usb_out_buffer == NULL)
+		return 0;
+
+	// Pool buffers hold whatever was last sent in them. Bytes a handler
+	// leaves unwritten, or a whole unknown query, go out as zeros.
+	memset(usb_out_buffer, 0, USB_TRL_TYPE);
+	return 1;
 }
 
 void usb_send(void)
 {
-	usb_rawhid_send(usb_out_buffer, TIMEOUT_SEND);
+	usb_send_report(usb_out_buffer, USB_RPT_REPLY);
+	usb_out_buffer = NULL;
+}
+
+uint8_t *usb_alloc(uint16_t timeout)
+{
+	usb_packet_t *packet = usb_link_tx_packet(timeout);
+
+	return packet ? packet->buf : NULL;
+}
+
+static void usb_trailer(uint8_t *buf, uint8_t type)
+{
+	// Advertise queue room so the host can keep the pipeline full.
+	buf[USB_TRL_TYPE] = type;
+	buf[USB_TRL_SEQ] = seg_seq;
+	buf[USB_TRL_CREDITS] = seg_free();
+}
+
+void usb_send_report(uint8_t *buf, uint8_t type)
+{
+	usb_trailer(buf, type);
+	usb_link_tx_commit(usb_packet(buf));
+}
+
+uint8_t usb_stream(uint8_t type, const uint8_t *buf, uint8_t len)
+{
+#ifdef USB_STREAM
+	uint8_t hdr[USB_STREAM_HDR] = {USB_STREAM_SYNC, type, len};
+
+	// Drop the frame rather than wait on a host that is not listening.
+	// Below the limit, a frame of up to two packets is written without waiting.
+	if (!usb_cdc_line_rtsdtr ||
+			usb_tx_packet_count(CDC_TX_ENDPOINT) >= USB_STREAM_TX_LIMIT)
+		return 0;
+
+	usb_serial_write(hdr, USB_STREAM_HDR);
+	usb_serial_write(buf, len);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// Runs in usb_isr() for packets with nothing queued ahead of them.
+static int usb_rx_isr(uint32_t endpoint, usb_packet_t *packet)
+{
+	uint32_t begin = hal_tick(), cycles;
+	uint8_t handled = 0;
+
+	// Without a handler the packet only wakes the main loop.
+	if (usb_fast_handler == NULL)
+	{
+		ev_post(EV_USB_RX);
+		return 0;
+	}
+
+	// A command still in the main loop has to finish first. A host that
+	// stops reading leaves replies to the main loop, which waits for room
+	// as usb_link_tx_packet() does, so the receive buffers are not used up.
+	if (!usb_rx_busy && usb_tx_packet_count(USB_TX_ENDPOINT) < USB_TX_LIMIT &&
+			usb_fast_handler(packet->buf))
+	{
+		// The packet is sent back as its own reply, and counted as transmit.
+		usb_trailer(packet->buf, USB_RPT_REPLY);
+		packet->len = BUF_SIZE;
+		usb_mem_give(packet, USB_TX_ENDPOINT);
+		usb_tx_isr(USB_TX_ENDPOINT, packet);
+		handled = 1;
+	}
+	else
+		ev_post(EV_USB_RX);
+
+	cycles = hal_tick_cycles(begin);
+	usb_fast_stats.last = cycles;
+	if (cycles > usb_fast_stats.max)
+		usb_fast_stats.max = cycles;
+	if (handled)
+		usb_fast_stats.handled++;
+	else
+		usb_fast_stats.deferred++;
+
+	return handled;
+}
+
+void usb_fast(usb_fast_t handler)
+{
+	usb_fast_handler = handler;
+}
+
+void usb_fast_clear(void)
+{
+	__disable_irq();
+	usb_fast_stats.handled = 0;
+	usb_fast_stats.deferred = 0;
+	usb_fast_stats.last = 0;
+	usb_fast_stats.max = 0;
+	__enable_irq();
+}
+
+void usb_send_credits(void)
+{
+	uint8_t *buf;
+
+	// Only the trailer matters, and a later reply carries it as well.
+	if (usb_tx_packet_count(USB_TX_ENDPOINT) >= USB_CREDITS_TX_LIMIT)
+		return;
+
+	buf = usb_alloc(0);
+	if (buf)
+		usb_send_report(buf, USB_RPT_CREDITS);
 }
 
 void usb_wait(void)
 {
-	while(!usb_rawhid_available());
+	while(!usb_link_available());
 	delay(USB_WAIT);
+
+	// Received packets post EV_USB_RX from here on. The callback only sees
+	// packets with none queued ahead, so look for any that came earlier.
+	usb_rx_set_callback(USB_RX_ENDPOINT, usb_rx_isr);
+	ev_post(EV_USB_RX);
 }
@@ -6,20 +6,76 @@
 #ifndef USB_H_
 #define USB_H_
 
-#include <usb_dev.h>
-#include <usb_rawhid.h>
+#include <hal.h>
+
+// Transport is chosen with OPTIONS in the Makefile.
+#if defined(USB_VENDOR)
+#define USB_TX_ENDPOINT 	VENDOR_TX_ENDPOINT
+#define USB_RX_ENDPOINT 	VENDOR_RX_ENDPOINT
+#define USB_TX_LIMIT 		8 	// Tx packets queued, as usb_vendor.c
+#else
+#define USB_TX_ENDPOINT 	RAWHID_TX_ENDPOINT
+#define USB_RX_ENDPOINT 	RAWHID_RX_ENDPOINT
+#define USB_TX_LIMIT 		4 	// Tx packets queued, as usb_rawhid.c
+#endif
+
+// Composite builds stream telemetry and traces on a CDC serial port.
+#if defined(USB_RAWHID_SERIAL)
+#define USB_STREAM 		1
+#endif
 
 #define TIMEOUT_RECV 	0 		// USB receive timeout
 #define TIMEOUT_SEND 	50 		// USB send timeout
 #define BUF_SIZE 		64 		// Size of USB buffers
 #define USB_WAIT 		1000 	// Milliseconds for the device to wait
 
-// USB buffers
-extern uint8_t usb_in_buffer[BUF_SIZE]; 		// Input buffer
-extern uint8_t usb_out_buffer[BUF_SIZE]; 		// Output buffer
+// Trailer carried by every report
+#define USB_TRL_TYPE 	(BUF_SIZE - 3) 	// One of USB_RPT_*
+#define USB_TRL_SEQ 	(BUF_SIZE - 2) 	// Last accepted segment sequence
+#define USB_TRL_CREDITS (BUF_SIZE - 1) 	// Free motion queue slots
+
+#define USB_RPT_REPLY 		0 	// Reply to a command
+#define USB_RPT_TELEMETRY 	1 	// Unsolicited telemetry report
+#define USB_RPT_CREDITS 	2 	// Motion queue drained, trailer only
+
+#define USB_CREDITS_TX_LIMIT 	2 	// Skip a credits report if this many are unsent
+
+// Frames on the stream port: sync, type, length, then the data
+#define USB_STREAM_SYNC 	0xA5 	// First byte of every frame
+#define USB_STREAM_HDR 		3 		// Bytes before the data
+#define USB_STREAM_TX_LIMIT 6 		// Queued packets before frames are dropped
+
+// Answers a command in place from the USB interrupt, see usb_fast().
+// Returns zero to leave the packet to usb_recv().
+typedef uint8_t (*usb_fast_t)(uint8_t *buf);
+
+typedef struct
+{
+	uint32_t handled; 		// Packets answered in the interrupt
+	uint32_t deferred; 		// Packets left to usb_recv()
+	uint32_t last; 			// Cycles taken by the last packet
+	uint32_t max; 			// Most cycles taken by one packet
+} usb_fast_stats_t;
+
+// USB buffers, pointing into the current rx and tx packets
+extern uint8_t *usb_in_buffer; 			// Input buffer
+extern uint8_t *usb_out_buffer; 		// Output buffer, set by usb_reply()
+extern uint32_t usb_rx_time; 			// micros() when usb_recv() took the packet
+extern volatile usb_fast_stats_t usb_fast_stats;
 
 uint8_t usb_recv(void); 		// Wrapper for receiving
+uint8_t *usb_keep(void); 		// Take over the current rx packet
+void usb_release(uint8_t *buf); // Free a packet taken by usb_keep()
+uint8_t usb_reply(void); 		// Start a zeroed reply in a tx packet
 void usb_send(void); 			// Wrapper for sending
-void usb_wait(void); 			// Wrapper for waiting for device to settle
+uint8_t *usb_alloc(uint16_t timeout); 				// Tx packet buffer
+void usb_send_report(uint8_t *buf, uint8_t type); 	// Queue a tx packet
+void usb_send_credits(void); 	// Report queue room without waiting
+
+// Write a frame to the stream port, all or nothing
+uint8_t usb_stream(uint8_t type, const uint8_t *buf, uint8_t len);
+void usb_wait(void); 			// Wait for the device, then post EV_USB_RX
+void usb_fast(usb_fast_t handler); 	// Offer packets to handler in the interrupt
+void usb_fast_clear(void); 		// Restart usb_fast_stats
 
 #endif
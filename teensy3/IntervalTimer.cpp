@@ -19,6 +19,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. */
 
 
 #include "IntervalTimer.h"
+#include "core_pins.h"
 
 
 // ------------------------------------------------------------
@@ -27,6 +28,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. */
 bool IntervalTimer::PIT_enabled;
 bool IntervalTimer::PIT_used[];
 IntervalTimer::ISR IntervalTimer::PIT_ISR[];
+bool IntervalTimer::PIT_oneshot[];
 
 
 
@@ -34,19 +36,24 @@ IntervalTimer::ISR IntervalTimer::PIT_ISR[];
 // these are the ISRs (Interrupt Service Routines) that get
 // called by each PIT timer when it fires. they're defined here
 // so that they can auto-clear themselves and so the user can
-// specify a custom ISR and reassign it as needed
+// specify a custom ISR and reassign it as needed. they run
+// from RAM, as every tick of a fast timer passes through them.
+// a one-shot timer is stopped before its ISR runs, which may
+// start it again
 // ------------------------------------------------------------
+#define PIT_ONESHOT(n) if (IntervalTimer::PIT_oneshot[n]) PIT_TCTRL##n = 0
+
 #if defined(KINETISK)
-void pit0_isr() { PIT_TFLG0 = 1; IntervalTimer::PIT_ISR[0](); }
-void pit1_isr() { PIT_TFLG1 = 1; IntervalTimer::PIT_ISR[1](); }
-void pit2_isr() { PIT_TFLG2 = 1; IntervalTimer::PIT_ISR[2](); }
-void pit3_isr() { PIT_TFLG3 = 1; IntervalTimer::PIT_ISR[3](); }
+void FASTRUN pit0_isr() { PIT_TFLG0 = 1; PIT_ONESHOT(0); IntervalTimer::PIT_ISR[0](); }
+void FASTRUN pit1_isr() { PIT_TFLG1 = 1; PIT_ONESHOT(1); IntervalTimer::PIT_ISR[1](); }
+void FASTRUN pit2_isr() { PIT_TFLG2 = 1; PIT_ONESHOT(2); IntervalTimer::PIT_ISR[2](); }
+void FASTRUN pit3_isr() { PIT_TFLG3 = 1; PIT_ONESHOT(3); IntervalTimer::PIT_ISR[3](); }
 
 #elif defined(KINETISL)
-void pit_isr() {
-	if (PIT_TFLG0) { PIT_TFLG0 = 1; IntervalTimer::PIT_ISR[0](); }
+void FASTRUN pit_isr() {
+	if (PIT_TFLG0) { PIT_TFLG0 = 1; PIT_ONESHOT(0); IntervalTimer::PIT_ISR[0](); }
 	if (!IntervalTimer::PIT_enabled) return;
-	if (PIT_TFLG1) { PIT_TFLG1 = 1; IntervalTimer::PIT_ISR[1](); }
+	if (PIT_TFLG1) { PIT_TFLG1 = 1; PIT_ONESHOT(1); IntervalTimer::PIT_ISR[1](); }
 }
 #endif
 
@@ -59,17 +66,20 @@ void pit_isr() {
 // make sure this function can complete within the time allowed.
 // attempts to allocate a timer using available resources,
 // returning true on success or false in case of failure.
-// period is specified as number of bus cycles
+// period is specified as number of bus cycles. with once set
+// the timer stops after its first interrupt
 // ------------------------------------------------------------
-bool IntervalTimer::beginCycles(ISR newISR, uint32_t newValue) {
+bool IntervalTimer::beginCycles(ISR newISR, uint32_t newValue, bool once) {
+
+  // store callback pointer and mode
+  myISR = newISR;
+  oneshot = once;
 
-  // if this interval timer is already running, stop it
+  // if this interval timer already has a PIT, restart it there
   if (status == TIMER_PIT) {
-    stop_PIT();
-    status = TIMER_OFF;
+    start_PIT(newValue);
+    return true;
   }
-  // store callback pointer
-  myISR = newISR;
   
   // attempt to allocate this timer
   if (allocate_PIT(newValue)) status = TIMER_PIT;
@@ -155,6 +165,7 @@ void IntervalTimer::start_PIT(uint32_t newValue) {
   
   // point to the correct PIT ISR
   PIT_ISR[PIT_id] = myISR;
+  PIT_oneshot[PIT_id] = oneshot;
   
   // write value to register and enable interrupt
   *PIT_TCTRL = 0;
@@ -180,12 +191,11 @@ void IntervalTimer::start_PIT(uint32_t newValue) {
 // ------------------------------------------------------------
 void IntervalTimer::stop_PIT() {
   
-  // disable interrupt and PIT
+  // disable interrupt and PIT, dropping a tick not yet handled
   *PIT_TCTRL = 0;
+  PIT_TCTRL[1] = 1;
 #if defined(KINETISK)
   NVIC_DISABLE_IRQ(IRQ_PIT_CH);
-#elif defined(KINETISL)
-  NVIC_DISABLE_IRQ(IRQ_PIT);
 #endif
   
   // free PIT for future use
@@ -196,7 +206,12 @@ void IntervalTimer::stop_PIT() {
     if (PIT_used[id]) return;
   }
   
-  // none used, disable PIT clock
+  // none used, disable PIT clock. on the LC both channels share one
+  // interrupt, so it is only disabled once neither is in use
+#if defined(KINETISL)
+  NVIC_DISABLE_IRQ(IRQ_PIT);
+  NVIC_CLEAR_PENDING(IRQ_PIT);
+#endif
   disable_PIT();
   
 }
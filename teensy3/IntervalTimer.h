@@ -43,6 +43,7 @@ class IntervalTimer {
     static bool PIT_enabled;
     static bool PIT_used[NUM_PIT];
     static ISR PIT_ISR[NUM_PIT];
+    static bool PIT_oneshot[NUM_PIT];
     bool allocate_PIT(uint32_t newValue);
     void start_PIT(uint32_t newValue);
     void stop_PIT();
@@ -52,10 +53,11 @@ class IntervalTimer {
     reg PIT_TCTRL;
     uint8_t IRQ_PIT_CH;
     uint8_t nvic_priority;
+    bool oneshot;
     ISR myISR;
-    bool beginCycles(ISR newISR, uint32_t cycles);
+    bool beginCycles(ISR newISR, uint32_t cycles, bool once = false);
   public:
-    IntervalTimer() { status = TIMER_OFF; nvic_priority = 128; }
+    IntervalTimer() { status = TIMER_OFF; nvic_priority = 128; oneshot = false; }
     ~IntervalTimer() { end(); }
     bool begin(ISR newISR, unsigned int newPeriod) {
 	if (newPeriod == 0 || newPeriod > MAX_PERIOD) return false;
@@ -81,6 +83,20 @@ class IntervalTimer {
     bool begin(ISR newISR, double newPeriod) {
 	return begin(newISR, (float)newPeriod);
     }
+    // call newISR once, newPeriod microseconds from now. the timer
+    // keeps its PIT afterwards, so calling this again is cheap
+    bool beginOneShot(ISR newISR, unsigned int newPeriod) {
+	if (newPeriod == 0 || newPeriod > MAX_PERIOD) return false;
+	uint32_t newValue = (F_BUS / 1000000) * newPeriod - 1;
+	return beginCycles(newISR, newValue, true);
+    }
+    // change the period of a running timer without stopping it. the
+    // current cycle runs out first, the new period starts at the reload
+    bool update(unsigned int newPeriod) {
+	if (status != TIMER_PIT || newPeriod == 0 || newPeriod > MAX_PERIOD) return false;
+	*PIT_LDVAL = (F_BUS / 1000000) * newPeriod - 1;
+	return true;
+    }
     void end();
     void priority(uint8_t n) {
 	nvic_priority = n;
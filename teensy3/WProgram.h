@@ -16,7 +16,6 @@
 #include "HardwareSerial.h"
 
 #define DMAMEM __attribute__ ((section(".dmabuffers"), used))
-#define FASTRUN __attribute__ ((section(".fastrun"), noinline, noclone ))
 
 #ifdef __cplusplus
 
@@ -47,6 +47,10 @@
 #define FALLING		2
 #define RISING		3
 
+// code placed in RAM, copied there with .data at startup, runs without
+// the flash wait states
+#define FASTRUN __attribute__ ((section(".fastrun"), noinline, noclone ))
+
 // Pin				Arduino
 //  0	B16			RXD
 //  1	B17			TXD
@@ -1074,6 +1078,11 @@ static inline uint32_t millis(void)
 }
 
 uint32_t micros(void);
+// never wrap, and like micros() never mask interrupts
+uint64_t micros64(void);
+uint64_t cycles64(void);
+// low half of cycles64(), without 64 bit arithmetic
+uint32_t cycles32(void);
 
 static inline void delayMicroseconds(uint32_t) __attribute__((always_inline, unused));
 static inline void delayMicroseconds(uint32_t usec)
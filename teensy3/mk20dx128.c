@@ -118,9 +118,10 @@ void unused_isr(void)
 }
 
 extern volatile uint32_t systick_millis_count;
+extern volatile uint32_t systick_millis_high;
 void systick_default_isr(void)
 {
-	systick_millis_count++;
+	if (++systick_millis_count == 0) systick_millis_high++;
 }
 
 void nmi_isr(void)		__attribute__ ((weak, alias("unused_isr")));
@@ -177,7 +177,7 @@ void detachInterrupt(uint8_t pin)
 
 #if defined(__MK20DX128__) || defined(__MK20DX256__)
 
-static void porta_interrupt(void)
+static void FASTRUN porta_interrupt(void)
 {
 	uint32_t isfr = PORTA_ISFR;
 	PORTA_ISFR = isfr;
@@ -187,7 +187,7 @@ static void porta_interrupt(void)
 	if ((isfr & CORE_PIN33_BITMASK) && intFunc[33]) intFunc[33]();
 }
 
-static void portb_interrupt(void)
+static void FASTRUN portb_interrupt(void)
 {
 	uint32_t isfr = PORTB_ISFR;
 	PORTB_ISFR = isfr;
@@ -201,7 +201,7 @@ static void portb_interrupt(void)
 	if ((isfr & CORE_PIN32_BITMASK) && intFunc[32]) intFunc[32]();
 }
 
-static void portc_interrupt(void)
+static void FASTRUN portc_interrupt(void)
 {
 	// TODO: these are inefficent.  Use CLZ somehow....
 	uint32_t isfr = PORTC_ISFR;
@@ -220,7 +220,7 @@ static void portc_interrupt(void)
 	if ((isfr & CORE_PIN30_BITMASK) && intFunc[30]) intFunc[30]();
 }
 
-static void portd_interrupt(void)
+static void FASTRUN portd_interrupt(void)
 {
 	uint32_t isfr = PORTD_ISFR;
 	PORTD_ISFR = isfr;
@@ -234,7 +234,7 @@ static void portd_interrupt(void)
 	if ((isfr & CORE_PIN21_BITMASK) && intFunc[21]) intFunc[21]();
 }
 
-static void porte_interrupt(void)
+static void FASTRUN porte_interrupt(void)
 {
 	uint32_t isfr = PORTE_ISFR;
 	PORTE_ISFR = isfr;
@@ -244,7 +244,7 @@ static void porte_interrupt(void)
 
 #elif defined(__MKL26Z64__)
 
-static void porta_interrupt(void)
+static void FASTRUN porta_interrupt(void)
 {
 	uint32_t isfr = PORTA_ISFR;
 	PORTA_ISFR = isfr;
@@ -252,7 +252,7 @@ static void porta_interrupt(void)
 	if ((isfr & CORE_PIN4_BITMASK) && intFunc[4]) intFunc[4]();
 }
 
-static void portcd_interrupt(void)
+static void FASTRUN portcd_interrupt(void)
 {
 	uint32_t isfr = PORTC_ISFR;
 	PORTC_ISFR = isfr;
@@ -868,29 +868,80 @@ uint8_t shiftIn_msbFirst(uint8_t dataPin, uint8_t clockPin)
 
 // the systick interrupt is supposed to increment this at 1 kHz rate
 volatile uint32_t systick_millis_count = 0;
+// and this each time the count wraps, every 49.7 days
+volatile uint32_t systick_millis_high = 0;
 
 //uint32_t systick_current, systick_count, systick_istatus;  // testing only
 
-uint32_t micros(void)
+// milliseconds and cycles into the current one, without masking
+// interrupts. the count only changes in the systick interrupt, so
+// it serves as a generation: if it moved, read everything again.
+// inside a handler that systick can't preempt it reads once
+static inline uint64_t systick_read(uint32_t *cycles) __attribute__((always_inline, unused));
+static inline uint64_t systick_read(uint32_t *cycles)
 {
-	uint32_t count, current, istatus;
-
-	__disable_irq();
-	current = SYST_CVR;
-	count = systick_millis_count;
-	istatus = SCB_ICSR;	// bit 26 indicates if systick exception pending
-	__enable_irq();
+	uint32_t count, high, current, istatus;
+	uint64_t ms;
+
+	do {
+		count = systick_millis_count;
+		high = systick_millis_high;
+		current = SYST_CVR;
+		istatus = SCB_ICSR;	// bit 26 indicates if systick exception pending
+	} while (count != systick_millis_count);
 	 //systick_current = current;
 	 //systick_count = count;
 	 //systick_istatus = istatus & SCB_ICSR_PENDSTSET ? 1 : 0;
-	if ((istatus & SCB_ICSR_PENDSTSET) && current > 50) count++;
-	current = ((F_CPU / 1000) - 1) - current;
+	ms = ((uint64_t)high << 32) | count;
+	if ((istatus & SCB_ICSR_PENDSTSET) && current > 50) ms++;
+	*cycles = ((F_CPU / 1000) - 1) - current;
+	return ms;
+}
+
+static inline uint32_t systick_cycles_to_micros(uint32_t current)
+{
 #if defined(KINETISL) && F_CPU == 48000000
-	return count * 1000 + ((current * (uint32_t)87381) >> 22);
+	return (current * (uint32_t)87381) >> 22;
 #elif defined(KINETISL) && F_CPU == 24000000
-	return count * 1000 + ((current * (uint32_t)174763) >> 22);
+	return (current * (uint32_t)174763) >> 22;
+#else
+	return current / (F_CPU / 1000000);
 #endif
-	return count * 1000 + current / (F_CPU / 1000000);
+}
+
+uint32_t micros(void)
+{
+	uint32_t current;
+	uint32_t count = systick_read(&current);
+
+	return count * 1000 + systick_cycles_to_micros(current);
+}
+
+uint64_t micros64(void)
+{
+	uint32_t current;
+	uint64_t count = systick_read(&current);
+
+	return count * 1000 + systick_cycles_to_micros(current);
+}
+
+// in RAM, as the firmware times its interrupts with it
+uint64_t FASTRUN cycles64(void)
+{
+	uint32_t current;
+	uint64_t count = systick_read(&current);
+
+	return count * (F_CPU / 1000) + current;
+}
+
+// low half of cycles64(), with a 32 bit multiply the M0+ does in one
+// instruction instead of a libgcc call into flash
+uint32_t FASTRUN cycles32(void)
+{
+	uint32_t current;
+	uint32_t count = systick_read(&current);
+
+	return count * (F_CPU / 1000) + current;
 }
 
 void delay(uint32_t ms)
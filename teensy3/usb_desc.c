@@ -355,7 +355,14 @@ static uint8_t flightsim_report_desc[] = {
 #define RAWHID_INTERFACE_DESC_SIZE	0
 #endif
 
-#define FLIGHTSIM_INTERFACE_DESC_POS	RAWHID_INTERFACE_DESC_POS+RAWHID_INTERFACE_DESC_SIZE
+#define VENDOR_INTERFACE_DESC_POS	RAWHID_INTERFACE_DESC_POS+RAWHID_INTERFACE_DESC_SIZE
+#ifdef  VENDOR_INTERFACE
+#define VENDOR_INTERFACE_DESC_SIZE	9+7+7
+#else
+#define VENDOR_INTERFACE_DESC_SIZE	0
+#endif
+
+#define FLIGHTSIM_INTERFACE_DESC_POS	VENDOR_INTERFACE_DESC_POS+VENDOR_INTERFACE_DESC_SIZE
 #ifdef  FLIGHTSIM_INTERFACE
 #define FLIGHTSIM_INTERFACE_DESC_SIZE	9+9+7+7
 #define FLIGHTSIM_HID_DESC_OFFSET	FLIGHTSIM_INTERFACE_DESC_POS+9
@@ -656,6 +663,33 @@ static uint8_t config_descriptor[CONFIG_DESC_SIZE] = {
         RAWHID_RX_INTERVAL,			// bInterval
 #endif // RAWHID_INTERFACE
 
+#ifdef VENDOR_INTERFACE
+        // interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
+        9,                                      // bLength
+        4,                                      // bDescriptorType
+        VENDOR_INTERFACE,                       // bInterfaceNumber
+        0,                                      // bAlternateSetting
+        2,                                      // bNumEndpoints
+        0xFF,                                   // bInterfaceClass (0xFF = Vendor)
+        0x00,                                   // bInterfaceSubClass
+        0x00,                                   // bInterfaceProtocol
+        0,                                      // iInterface
+        // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+        7,                                      // bLength
+        5,                                      // bDescriptorType
+        VENDOR_TX_ENDPOINT | 0x80,              // bEndpointAddress
+        0x02,                                   // bmAttributes (0x02=bulk)
+        VENDOR_TX_SIZE, 0,                      // wMaxPacketSize
+        0,                                      // bInterval
+        // endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
+        7,                                      // bLength
+        5,                                      // bDescriptorType
+        VENDOR_RX_ENDPOINT,                     // bEndpointAddress
+        0x02,                                   // bmAttributes (0x02=bulk)
+        VENDOR_RX_SIZE, 0,                      // wMaxPacketSize
+        0,                                      // bInterval
+#endif // VENDOR_INTERFACE
+
 #ifdef FLIGHTSIM_INTERFACE
         // interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
         9,                                      // bLength
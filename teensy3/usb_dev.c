@@ -43,6 +43,9 @@
 #include "kinetis.h"
 //#include "HardwareSerial.h"
 #include "usb_mem.h"
+#ifdef TRACE
+#include <trace.h>
+#endif
 
 // buffer descriptor table
 
@@ -56,9 +59,14 @@ static bdt_t table[(NUM_ENDPOINTS+1)*4];
 
 static usb_packet_t *rx_first[NUM_ENDPOINTS];
 static usb_packet_t *rx_last[NUM_ENDPOINTS];
+// offered each packet before it is queued, see usb_rx_set_callback()
+static usb_rx_callback_t rx_callback[NUM_ENDPOINTS];
 static usb_packet_t *tx_first[NUM_ENDPOINTS];
 static usb_packet_t *tx_last[NUM_ENDPOINTS];
 uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
+// kept by usb_tx() and the ISR, so counting queued packets is constant time
+volatile uint16_t usb_tx_byte_count_data[NUM_ENDPOINTS];
+volatile uint8_t usb_tx_packet_count_data[NUM_ENDPOINTS];
 
 static uint8_t tx_state[NUM_ENDPOINTS];
 #define TX_STATE_BOTH_FREE_EVEN_FIRST	0
@@ -206,6 +214,8 @@ static void usb_setup(void)
 			tx_first[i] = NULL;
 			tx_last[i] = NULL;
 			usb_rx_byte_count_data[i] = 0;
+			usb_tx_byte_count_data[i] = 0;
+			usb_tx_packet_count_data[i] = 0;
 			switch (tx_state[i]) {
 			  case TX_STATE_EVEN_FREE:
 			  case TX_STATE_NONE_FREE_EVEN_FIRST:
@@ -555,18 +565,6 @@ usb_packet_t *usb_rx(uint32_t endpoint)
 	return ret;
 }
 
-static uint32_t usb_queue_byte_count(const usb_packet_t *p)
-{
-	uint32_t count=0;
-
-	__disable_irq();
-	for ( ; p; p = p->next) {
-		count += p->len;
-	}
-	__enable_irq();
-	return count;
-}
-
 // TODO: make this an inline function...
 /*
 uint32_t usb_rx_byte_count(uint32_t endpoint)
@@ -578,25 +576,7 @@ uint32_t usb_rx_byte_count(uint32_t endpoint)
 }
 */
 
-uint32_t usb_tx_byte_count(uint32_t endpoint)
-{
-	endpoint--;
-	if (endpoint >= NUM_ENDPOINTS) return 0;
-	return usb_queue_byte_count(tx_first[endpoint]);
-}
-
-uint32_t usb_tx_packet_count(uint32_t endpoint)
-{
-	const usb_packet_t *p;
-	uint32_t count=0;
-
-	endpoint--;
-	if (endpoint >= NUM_ENDPOINTS) return 0;
-	__disable_irq();
-	for (p = tx_first[endpoint]; p; p = p->next) count++;
-	__enable_irq();
-	return count;
-}
+// usb_tx_byte_count() and usb_tx_packet_count() are inline in usb_dev.h
 
 
 // Called from usb_free, but only when usb_rx_memory_needed > 0, indicating
@@ -649,14 +629,12 @@ void usb_rx_memory(usb_packet_t *packet)
 //#define index(endpoint, tx, odd) (((endpoint) << 2) | ((tx) << 1) | (odd))
 //#define stat2bufferdescriptor(stat) (table + ((stat) >> 2))
 
-void usb_tx(uint32_t endpoint, usb_packet_t *packet)
+// Shared by usb_tx() and usb_tx_isr(), interrupts must be disabled
+static void usb_tx_queue(uint32_t endpoint, usb_packet_t *packet)
 {
-	bdt_t *b = &table[index(endpoint, TX, EVEN)];
+	bdt_t *b = &table[index(endpoint + 1, TX, EVEN)];
 	uint8_t next;
 
-	endpoint--;
-	if (endpoint >= NUM_ENDPOINTS) return;
-	__disable_irq();
 	//serial_print("txstate=");
 	//serial_phex(tx_state[endpoint]);
 	//serial_print("\n");
@@ -682,15 +660,39 @@ void usb_tx(uint32_t endpoint, usb_packet_t *packet)
 			tx_last[endpoint]->next = packet;
 		}
 		tx_last[endpoint] = packet;
-		__enable_irq();
+		usb_tx_packet_count_data[endpoint]++;
+		usb_tx_byte_count_data[endpoint] += packet->len;
 		return;
 	}
 	tx_state[endpoint] = next;
 	b->addr = packet->buf;
 	b->desc = BDT_DESC(packet->len, ((uint32_t)b & 8) ? DATA1 : DATA0);
+}
+
+void usb_tx(uint32_t endpoint, usb_packet_t *packet)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS) return;
+	__disable_irq();
+	usb_tx_queue(endpoint, packet);
 	__enable_irq();
 }
 
+// Same as usb_tx(), for callers already inside usb_isr()
+void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS) return;
+	usb_tx_queue(endpoint, packet);
+}
+
+void usb_rx_set_callback(uint32_t endpoint, usb_rx_callback_t callback)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS) return;
+	rx_callback[endpoint] = callback;
+}
+
 
 
 
@@ -704,7 +706,21 @@ void _reboot_Teensyduino_(void)
 
 
 
+#ifdef TRACE
+static void usb_isr_untimed(void);
+
+// timed here, so the vector table entry reaches it, see trace.h
 void usb_isr(void)
+{
+	TRACE_ENTER(TRACE_USB);
+	usb_isr_untimed();
+	TRACE_EXIT(TRACE_USB);
+}
+
+static void usb_isr_untimed(void)
+#else
+void usb_isr(void)
+#endif
 {
 	uint8_t status, stat, t;
 
@@ -777,6 +793,8 @@ void usb_isr(void)
 				if (packet) {
 					//serial_print("tx packet\n");
 					tx_first[endpoint] = packet->next;
+					usb_tx_packet_count_data[endpoint]--;
+					usb_tx_byte_count_data[endpoint] -= packet->len;
 					b->addr = packet->buf;
 					switch (tx_state[endpoint]) {
 					  case TX_STATE_BOTH_FREE_EVEN_FIRST:
@@ -818,23 +836,30 @@ void usb_isr(void)
 				if (packet->len > 0) {
 					packet->index = 0;
 					packet->next = NULL;
-					if (rx_first[endpoint] == NULL) {
-						//serial_print("rx 1st, epidx=");
-						//serial_phex(endpoint);
-						//serial_print(", packet=");
-						//serial_phex32((uint32_t)packet);
-						//serial_print("\n");
-						rx_first[endpoint] = packet;
+					// a callback may only take packets that would be
+					// next out of usb_rx(), so the order is kept
+					if (rx_first[endpoint] == NULL && rx_callback[endpoint]
+					  && rx_callback[endpoint](endpoint + 1, packet)) {
+						// now owned by the callback
 					} else {
-						//serial_print("rx Nth, epidx=");
-						//serial_phex(endpoint);
-						//serial_print(", packet=");
-						//serial_phex32((uint32_t)packet);
-						//serial_print("\n");
-						rx_last[endpoint]->next = packet;
+						if (rx_first[endpoint] == NULL) {
+							//serial_print("rx 1st, epidx=");
+							//serial_phex(endpoint);
+							//serial_print(", packet=");
+							//serial_phex32((uint32_t)packet);
+							//serial_print("\n");
+							rx_first[endpoint] = packet;
+						} else {
+							//serial_print("rx Nth, epidx=");
+							//serial_phex(endpoint);
+							//serial_print(", packet=");
+							//serial_phex32((uint32_t)packet);
+							//serial_print("\n");
+							rx_last[endpoint]->next = packet;
+						}
+						rx_last[endpoint] = packet;
+						usb_rx_byte_count_data[endpoint] += packet->len;
 					}
-					rx_last[endpoint] = packet;
-					usb_rx_byte_count_data[endpoint] += packet->len;
 					// TODO: implement a per-endpoint maximum # of allocated packets
 					// so a flood of incoming data on 1 endpoint doesn't starve
 					// the others if the user isn't reading it regularly
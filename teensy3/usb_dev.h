@@ -51,11 +51,17 @@ void usb_init(void);
 void usb_init_serialnumber(void);
 void usb_isr(void);
 usb_packet_t *usb_rx(uint32_t endpoint);
-uint32_t usb_tx_byte_count(uint32_t endpoint);
-uint32_t usb_tx_packet_count(uint32_t endpoint);
 void usb_tx(uint32_t endpoint, usb_packet_t *packet);
 void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet);
 
+// Called from usb_isr() with each packet received on the endpoint while
+// nothing is waiting in usb_rx().  Returning non-zero takes the packet over,
+// it is then never seen by usb_rx() and the callback must free or send it.
+// Returning zero queues it as usual.  Keep the callback short, the USB
+// interrupt is held for as long as it runs.
+typedef int (*usb_rx_callback_t)(uint32_t endpoint, usb_packet_t *packet);
+void usb_rx_set_callback(uint32_t endpoint, usb_rx_callback_t callback);
+
 extern volatile uint8_t usb_configuration;
 
 extern uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
@@ -67,6 +73,25 @@ static inline uint32_t usb_rx_byte_count(uint32_t endpoint)
         return usb_rx_byte_count_data[endpoint];
 }
 
+// Packets and bytes queued behind the ones already given to the hardware
+extern volatile uint16_t usb_tx_byte_count_data[NUM_ENDPOINTS];
+static inline uint32_t usb_tx_byte_count(uint32_t endpoint) __attribute__((always_inline));
+static inline uint32_t usb_tx_byte_count(uint32_t endpoint)
+{
+        endpoint--;
+        if (endpoint >= NUM_ENDPOINTS) return 0;
+        return usb_tx_byte_count_data[endpoint];
+}
+
+extern volatile uint8_t usb_tx_packet_count_data[NUM_ENDPOINTS];
+static inline uint32_t usb_tx_packet_count(uint32_t endpoint) __attribute__((always_inline));
+static inline uint32_t usb_tx_packet_count(uint32_t endpoint)
+{
+        endpoint--;
+        if (endpoint >= NUM_ENDPOINTS) return 0;
+        return usb_tx_packet_count_data[endpoint];
+}
+
 #ifdef CDC_DATA_INTERFACE
 extern uint32_t usb_cdc_line_coding[2];
 extern volatile uint8_t usb_cdc_line_rtsdtr;
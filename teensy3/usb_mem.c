@@ -38,14 +38,26 @@
 __attribute__ ((section(".usbbuffers"), used))
 unsigned char usb_buffer_memory[NUM_USB_BUFFERS * sizeof(usb_packet_t)];
 
+#if NUM_USB_BUFFERS > 32
+#error "NUM_USB_BUFFERS is limited to 32 by the free bitmap"
+#endif
+
 static uint32_t usb_buffer_available = 0xFFFFFFFF;
 
+// endpoint holding each buffer, and usage counters
+static uint8_t usb_buffer_owner[NUM_USB_BUFFERS];
+static usb_mem_stats_t usb_mem_pool = {0, 0, 0, 0, NUM_USB_BUFFERS};
+static usb_mem_stats_t usb_mem_ep[NUM_ENDPOINTS + 1] = {
+	[0] = {0, 0, 0, 0, NUM_USB_BUFFERS},
+	[1 ... NUM_ENDPOINTS] = {0, 0, 0, 0, USB_MEM_TX_QUOTA}
+};
+
 // use bitmask and CLZ instruction to implement fast free list
 // http://www.archivum.info/gnu.gcc.help/2006-08/00148/Re-GCC-Inline-Assembly.html
 // http://gcc.gnu.org/ml/gcc/2012-06/msg00015.html
 // __builtin_clz()
 
-usb_packet_t * usb_malloc(void)
+static usb_packet_t * usb_malloc_owner(uint8_t ep)
 {
 	unsigned int n, avail;
 	uint8_t *p;
@@ -53,7 +65,11 @@ usb_packet_t * usb_malloc(void)
 	__disable_irq();
 	avail = usb_buffer_available;
 	n = __builtin_clz(avail); // clz = count leading zeros
-	if (n >= NUM_USB_BUFFERS) {
+	if (n >= NUM_USB_BUFFERS ||
+	  usb_mem_ep[ep].in_use >= usb_mem_ep[ep].quota ||
+	  (ep && usb_mem_pool.in_use >= NUM_USB_BUFFERS - USB_MEM_RX_RESERVE)) {
+		usb_mem_pool.fails++;
+		usb_mem_ep[ep].fails++;
 		__enable_irq();
 		return NULL;
 	}
@@ -62,6 +78,13 @@ usb_packet_t * usb_malloc(void)
 	//serial_print("\n");
 
 	usb_buffer_available = avail & ~(0x80000000 >> n);
+	usb_buffer_owner[n] = ep;
+	usb_mem_pool.allocs++;
+	if (++usb_mem_pool.in_use > usb_mem_pool.high_water)
+		usb_mem_pool.high_water = usb_mem_pool.in_use;
+	usb_mem_ep[ep].allocs++;
+	if (++usb_mem_ep[ep].in_use > usb_mem_ep[ep].high_water)
+		usb_mem_ep[ep].high_water = usb_mem_ep[ep].in_use;
 	__enable_irq();
 	p = usb_buffer_memory + (n * sizeof(usb_packet_t));
 	//serial_print("malloc:");
@@ -72,6 +95,63 @@ usb_packet_t * usb_malloc(void)
 	return (usb_packet_t *)p;
 }
 
+usb_packet_t * usb_malloc(void)
+{
+	return usb_malloc_owner(0);
+}
+
+// transmit code tags its buffers, so each endpoint is held to its quota
+usb_packet_t * usb_malloc_ep(uint8_t endpoint)
+{
+	if (endpoint > NUM_ENDPOINTS) endpoint = 0;
+	return usb_malloc_owner(endpoint);
+}
+
+// count a held buffer against another endpoint, as when a received packet
+// is sent back as its own reply
+void usb_mem_give(usb_packet_t *p, uint8_t endpoint)
+{
+	unsigned int n;
+
+	n = ((uint8_t *)p - usb_buffer_memory) / sizeof(usb_packet_t);
+	if (n >= NUM_USB_BUFFERS || endpoint > NUM_ENDPOINTS) return;
+
+	__disable_irq();
+	usb_mem_ep[usb_buffer_owner[n]].in_use--;
+	usb_buffer_owner[n] = endpoint;
+	if (++usb_mem_ep[endpoint].in_use > usb_mem_ep[endpoint].high_water)
+		usb_mem_ep[endpoint].high_water = usb_mem_ep[endpoint].in_use;
+	__enable_irq();
+}
+
+const usb_mem_stats_t * usb_mem_stats(uint8_t endpoint)
+{
+	if (endpoint == USB_MEM_POOL) return &usb_mem_pool;
+	if (endpoint > NUM_ENDPOINTS) return NULL;
+	return &usb_mem_ep[endpoint];
+}
+
+void usb_mem_set_quota(uint8_t endpoint, uint8_t quota)
+{
+	if (endpoint == 0 || endpoint > NUM_ENDPOINTS) return;
+	usb_mem_ep[endpoint].quota = quota;
+}
+
+// restart the counters, buffers held now stay counted
+void usb_mem_clear_stats(void)
+{
+	unsigned int i;
+
+	__disable_irq();
+	usb_mem_pool.allocs = usb_mem_pool.fails = 0;
+	usb_mem_pool.high_water = usb_mem_pool.in_use;
+	for (i = 0; i <= NUM_ENDPOINTS; i++) {
+		usb_mem_ep[i].allocs = usb_mem_ep[i].fails = 0;
+		usb_mem_ep[i].high_water = usb_mem_ep[i].in_use;
+	}
+	__enable_irq();
+}
+
 // for the receive endpoints to request memory
 extern uint8_t usb_rx_memory_needed;
 extern void usb_rx_memory(usb_packet_t *packet);
@@ -86,9 +166,22 @@ void usb_free(usb_packet_t *p)
 	//serial_phex(n);
 	//serial_print("\n");
 
+	__disable_irq();
+	usb_mem_ep[usb_buffer_owner[n]].in_use--;
+	usb_buffer_owner[n] = 0;
+	__enable_irq();
+
 	// if any endpoints are starving for memory to receive
 	// packets, give this memory to them immediately!
 	if (usb_rx_memory_needed && usb_configuration) {
+		// counted as a fresh allocation by the receive side, as
+		// usb_malloc() would, the pool's in_use is unchanged
+		__disable_irq();
+		usb_mem_pool.allocs++;
+		usb_mem_ep[0].allocs++;
+		if (++usb_mem_ep[0].in_use > usb_mem_ep[0].high_water)
+			usb_mem_ep[0].high_water = usb_mem_ep[0].in_use;
+		__enable_irq();
 		//serial_print("give to rx:");
 		//serial_phex32((int)p);
 		//serial_print("\n");
@@ -99,6 +192,7 @@ void usb_free(usb_packet_t *p)
 	mask = (0x80000000 >> n);
 	__disable_irq();
 	usb_buffer_available |= mask;
+	usb_mem_pool.in_use--;
 	__enable_irq();
 
 	//serial_print("free:");
@@ -40,12 +40,39 @@ typedef struct usb_packet_struct {
 	uint8_t buf[64];
 } usb_packet_t;
 
+// Buffers that allocations tagged with an endpoint must leave for receive
+#ifndef USB_MEM_RX_RESERVE
+#define USB_MEM_RX_RESERVE	2
+#endif
+
+// Buffers one transmit endpoint may hold at once
+#ifndef USB_MEM_TX_QUOTA
+#define USB_MEM_TX_QUOTA	8
+#endif
+
+// Pool usage, for the whole pool and for each endpoint.  Endpoint 0 counts
+// receive buffers and allocations that are not tagged with an endpoint.
+#define USB_MEM_POOL		0xFF
+
+typedef struct {
+	uint32_t allocs;	// successful allocations
+	uint32_t fails;		// allocations refused, pool empty or over quota
+	uint8_t in_use;		// buffers held now
+	uint8_t high_water;	// most buffers held at once
+	uint8_t quota;		// most buffers allowed
+} usb_mem_stats_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 usb_packet_t * usb_malloc(void);
+usb_packet_t * usb_malloc_ep(uint8_t endpoint);
 void usb_free(usb_packet_t *p);
+void usb_mem_give(usb_packet_t *p, uint8_t endpoint);
+const usb_mem_stats_t * usb_mem_stats(uint8_t endpoint);
+void usb_mem_set_quota(uint8_t endpoint, uint8_t quota);
+void usb_mem_clear_stats(void);
 
 #ifdef __cplusplus
 }
@@ -54,6 +54,13 @@ int usb_rawhid_recv(void *buffer, uint32_t timeout)
 	return RAWHID_RX_SIZE;
 }
 
+// Zero copy receive: the caller owns the packet and must usb_free() it
+usb_packet_t *usb_rawhid_rx_packet(void)
+{
+	if (!usb_configuration) return NULL;
+	return usb_rx(RAWHID_RX_ENDPOINT);
+}
+
 int usb_rawhid_available(void)
 {
 	uint32_t count;
@@ -74,7 +81,7 @@ int usb_rawhid_send(const void *buffer, uint32_t timeout)
 	while (1) {
 		if (!usb_configuration) return -1;
 		if (usb_tx_packet_count(RAWHID_TX_ENDPOINT) < TX_PACKET_LIMIT) {
-			tx_packet = usb_malloc();
+			tx_packet = usb_malloc_ep(RAWHID_TX_ENDPOINT);
 			if (tx_packet) break;
 		}
 		if (millis() - begin > timeout) return 0;
@@ -86,5 +93,29 @@ int usb_rawhid_send(const void *buffer, uint32_t timeout)
 	return RAWHID_TX_SIZE;
 }
 
+// Zero copy transmit: fill the packet's buf, then pass it to
+// usb_rawhid_tx_commit().  A zero timeout does not wait at all.
+usb_packet_t *usb_rawhid_tx_packet(uint32_t timeout)
+{
+	usb_packet_t *tx_packet;
+	uint32_t begin = millis();
+
+	while (1) {
+		if (!usb_configuration) return NULL;
+		if (usb_tx_packet_count(RAWHID_TX_ENDPOINT) < TX_PACKET_LIMIT) {
+			tx_packet = usb_malloc_ep(RAWHID_TX_ENDPOINT);
+			if (tx_packet) return tx_packet;
+		}
+		if (!timeout || millis() - begin > timeout) return NULL;
+		yield();
+	}
+}
+
+void usb_rawhid_tx_commit(usb_packet_t *tx_packet)
+{
+	tx_packet->len = RAWHID_TX_SIZE;
+	usb_tx(RAWHID_TX_ENDPOINT, tx_packet);
+}
+
 #endif // F_CPU
 #endif // RAWHID_INTERFACE
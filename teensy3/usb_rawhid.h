@@ -36,6 +36,7 @@
 #if defined(RAWHID_INTERFACE)
 
 #include <inttypes.h>
+#include "usb_mem.h"
 
 // C language implementation
 #ifdef __cplusplus
@@ -44,6 +45,9 @@ extern "C" {
 int usb_rawhid_recv(void *buffer, uint32_t timeout);
 int usb_rawhid_available(void);
 int usb_rawhid_send(const void *buffer, uint32_t timeout);
+usb_packet_t *usb_rawhid_rx_packet(void);
+usb_packet_t *usb_rawhid_tx_packet(uint32_t timeout);
+void usb_rawhid_tx_commit(usb_packet_t *tx_packet);
 #ifdef __cplusplus
 }
 #endif
@@ -196,7 +196,7 @@ int usb_serial_write(const void *buffer, uint32_t size)
 				}
 				if (usb_tx_packet_count(CDC_TX_ENDPOINT) < TX_PACKET_LIMIT) {
 					tx_noautoflush = 1;
-					tx_packet = usb_malloc();
+					tx_packet = usb_malloc_ep(CDC_TX_ENDPOINT);
 					if (tx_packet) break;
 					tx_noautoflush = 0;
 				}
@@ -233,7 +233,7 @@ int usb_serial_write_buffer_free(void)
 	if (!tx_packet) {
 		if (!usb_configuration ||
 		  usb_tx_packet_count(CDC_TX_ENDPOINT) >= TX_PACKET_LIMIT ||
-		  (tx_packet = usb_malloc()) == NULL) {
+		  (tx_packet = usb_malloc_ep(CDC_TX_ENDPOINT)) == NULL) {
 			tx_noautoflush = 0;
 			return 0;
 		}
@@ -260,7 +260,7 @@ void usb_serial_flush_output(void)
 		usb_tx(CDC_TX_ENDPOINT, tx_packet);
 		tx_packet = NULL;
 	} else {
-		usb_packet_t *tx = usb_malloc();
+		usb_packet_t *tx = usb_malloc_ep(CDC_TX_ENDPOINT);
 		if (tx) {
 			usb_cdc_transmit_flush_timer = 0;
 			usb_tx(CDC_TX_ENDPOINT, tx);
@@ -279,7 +279,7 @@ void usb_serial_flush_callback(void)
 		usb_tx(CDC_TX_ENDPOINT, tx_packet);
 		tx_packet = NULL;
 	} else {
-		usb_packet_t *tx = usb_malloc();
+		usb_packet_t *tx = usb_malloc_ep(CDC_TX_ENDPOINT);
 		if (tx) {
 			usb_tx(CDC_TX_ENDPOINT, tx);
 		} else {
@@ -170,6 +170,21 @@
 #ifdef RAWHID_RX_INTERVAL
 #undef RAWHID_RX_INTERVAL
 #endif
+#ifdef VENDOR_INTERFACE
+#undef VENDOR_INTERFACE
+#endif
+#ifdef VENDOR_TX_ENDPOINT
+#undef VENDOR_TX_ENDPOINT
+#endif
+#ifdef VENDOR_TX_SIZE
+#undef VENDOR_TX_SIZE
+#endif
+#ifdef VENDOR_RX_ENDPOINT
+#undef VENDOR_RX_ENDPOINT
+#endif
+#ifdef VENDOR_RX_SIZE
+#undef VENDOR_RX_SIZE
+#endif
 #ifdef FLIGHTSIM_INTERFACE
 #undef FLIGHTSIM_TX_ENDPOINT
 #endif
@@ -0,0 +1,80 @@
+/* Teensyduino Core Library
+ * http://www.pjrc.com/teensy/
+ * Copyright (c) 2013 PJRC.COM, LLC.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * 1. The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * 2. If the Software is incorporated into a build system that allows
+ * selection among a list of target devices, then similar target
+ * devices manufactured by PJRC.COM must be included in the list of
+ * target devices and selectable in the same manner.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "usb_dev.h"
+#include "usb_vendor.h"
+#include "core_pins.h" // for yield(), millis()
+
+#ifdef VENDOR_INTERFACE // defined by usb_dev.h -> usb_desc.h
+#if F_CPU >= 20000000
+
+// Bulk endpoints can move several packets per frame, so allow a deeper
+// transmit queue than RawHID while still leaving memory for receiving.
+#define TX_PACKET_LIMIT 8
+
+// The caller owns the packet and must usb_free() it
+usb_packet_t *usb_vendor_rx_packet(void)
+{
+	if (!usb_configuration) return NULL;
+	return usb_rx(VENDOR_RX_ENDPOINT);
+}
+
+int usb_vendor_available(void)
+{
+	if (!usb_configuration) return 0;
+	return usb_rx_byte_count(VENDOR_RX_ENDPOINT);
+}
+
+// Fill the packet's buf, then pass it to usb_vendor_tx_commit().
+// A zero timeout does not wait at all.
+usb_packet_t *usb_vendor_tx_packet(uint32_t timeout)
+{
+	usb_packet_t *tx_packet;
+	uint32_t begin = millis();
+
+	while (1) {
+		if (!usb_configuration) return NULL;
+		if (usb_tx_packet_count(VENDOR_TX_ENDPOINT) < TX_PACKET_LIMIT) {
+			tx_packet = usb_malloc_ep(VENDOR_TX_ENDPOINT);
+			if (tx_packet) return tx_packet;
+		}
+		if (!timeout || millis() - begin > timeout) return NULL;
+		yield();
+	}
+}
+
+void usb_vendor_tx_commit(usb_packet_t *tx_packet)
+{
+	tx_packet->len = VENDOR_TX_SIZE;
+	usb_tx(VENDOR_TX_ENDPOINT, tx_packet);
+}
+
+#endif // F_CPU
+#endif // VENDOR_INTERFACE